@@ -129,8 +129,6 @@ static void prvAppTask(void *pvParameters)
 
     // Main application loop
     uint32_t message_count = 0;
-    uint32_t confirmed_attempts = 0;
-    uint32_t confirmed_acks = 0;
     for (;;) {
         char message[32];
         snprintf(message, sizeof(message), "Confirmed%lu", message_count++);
@@ -142,7 +140,6 @@ static void prvAppTask(void *pvParameters)
     // Under FreeRTOS, the library uses semaphores and its internal processing task
     // for precise RX window handling.
     int result = lorawan_send_confirmed_wait(message, strlen(message), 1, 90000);
-        confirmed_attempts++;
         int ack = lorawan_last_ack_received();
         
         // Check for any pending downlinks immediately after send
@@ -160,7 +157,6 @@ static void prvAppTask(void *pvParameters)
         }
         
         if (result == 0) {
-            confirmed_acks += ack ? 1 : 0; // Should always be 1 here, but guard for consistency
             printf("Confirmed message sent and acknowledged successfully!\n");
         } else if (result == -2) {
             printf("Confirmed message NOT acknowledged (RX1/RX2 timeout or NACK).\n");
@@ -176,9 +172,13 @@ static void prvAppTask(void *pvParameters)
         if (lorawan_get_devaddr(&devaddr) == 0 && lorawan_get_adr_enabled(&adr_enabled) == 0) {
             printf("DevAddr: %08X | ADR: %s\n", devaddr, adr_enabled ? "ON" : "OFF");
         }
-        // ACK success ratio
-        float ratio = confirmed_attempts ? ((float)confirmed_acks / (float)confirmed_attempts) * 100.0f : 0.0f;
-        printf("ACK Ratio: %lu/%lu (%.1f%%)\n", confirmed_acks, confirmed_attempts, ratio);
+        // ACK success ratio, from the library's MAC statistics
+        struct lorawan_stats stats;
+        if (lorawan_get_stats(&stats) == 0) {
+            float ratio = stats.confirmed_uplinks ? ((float)stats.acks / (float)stats.confirmed_uplinks) * 100.0f : 0.0f;
+            printf("ACK Ratio: %lu/%lu (%.1f%%) | Retransmissions: %lu | Airtime: %lu ms\n",
+                   stats.acks, stats.confirmed_uplinks, ratio, stats.retransmissions, stats.airtime_ms);
+        }
         
         printf("Available heap: %d bytes\n", xPortGetFreeHeapSize());
 
@@ -4,9 +4,9 @@
  * SPDX-License-Identifier: BSD-3-Clause
  * 
  * This example uses OTAA to join the LoRaWAN network and then sends the 
- * internal temperature sensors value up as an uplink message periodically 
- * and the first byte of any uplink messages received controls the boards
- * built-in LED.
+ * internal temperature sensors value up as an uplink message when it changes
+ * (or at least every 15 minutes) and the first byte of any uplink messages
+ * received controls the boards built-in LED.
  */
 
 #include <stdio.h>
@@ -17,6 +17,7 @@
 
 #include "pico/stdlib.h"
 #include "pico/lorawan.h"
+#include "pico/lorawan_report.h"
 #include "tusb.h"
 
 // edit with LoRaWAN Node Region and OTAA settings 
@@ -44,6 +45,19 @@ const struct lorawan_otaa_settings otaa_settings = {
     .channel_mask = LORAWAN_CHANNEL_MASK
 };
 
+// report the temperature when it changes by 1 °C, 
+// needing another 0.5 °C to report a move back, or every 15 minutes
+const struct lorawan_report_channel_settings report_settings[] = {
+    {
+        .deadband       = 1.0,
+        .rate_threshold = 0,
+        .hysteresis     = 0.5,
+        .max_silence_ms = 15 * 60 * 1000
+    }
+};
+
+struct lorawan_report report;
+
 // variables for receiving data
 int receive_length = 0;
 uint8_t receive_buffer[242];
@@ -69,6 +83,8 @@ int main( void )
 
     internal_temperature_init();
 
+    lorawan_report_init(&report, report_settings, 1);
+
     // uncomment next line to enable debug
     // lorawan_debug(true);
 
@@ -96,14 +112,22 @@ int main( void )
     // loop forever
     while (1) {
         // get the internal temperature
-        int8_t adc_temperature_byte = internal_temperature_get();
-
-        // send the internal temperature as a (signed) byte in an unconfirmed uplink message
-        printf("sending internal temperature: %d °C (0x%02x)... ", adc_temperature_byte, adc_temperature_byte);
-        if (lorawan_send_unconfirmed(&adc_temperature_byte, sizeof(adc_temperature_byte), 2) < 0) {
-            printf("failed!!!\n");
-        } else {
-            printf("success!\n");
+        float adc_temperature = internal_temperature_get();
+        int8_t adc_temperature_byte = adc_temperature;
+
+        lorawan_report_sample(&report, 0, adc_temperature);
+
+        // only use airtime when the temperature changed or the heartbeat is due
+        if (lorawan_report_due(&report)) {
+            // send the internal temperature as a (signed) byte in an unconfirmed uplink message
+            printf("sending internal temperature: %d °C (0x%02x)... ", adc_temperature_byte, adc_temperature_byte);
+            if (lorawan_send_unconfirmed(&adc_temperature_byte, sizeof(adc_temperature_byte), 2) < 0) {
+                printf("failed!!!\n");
+            } else {
+                printf("success!\n");
+
+                lorawan_report_sent(&report);
+            }
         }
 
         // wait for up to 30 seconds for an event
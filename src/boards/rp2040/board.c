@@ -10,9 +10,101 @@
 
 #include "pico.h"
 #include "pico/unique_id.h"
+#include "hardware/clocks.h"
 #include "hardware/sync.h"
+#include "hardware/watchdog.h"
+
+#if USE_FREERTOS
+#include "FreeRTOS.h"
+#include "hardware/structs/systick.h"
+#endif
 
 #include "board.h"
+#include "sx1276-board.h"
+
+extern void SpiUpdateBaudrate( Spi_t *obj );
+
+/*!
+ * System clock used while the MAC is idle, 0 when clock scaling is disabled
+ */
+static uint32_t ClockLowKhz = 0;
+
+/*!
+ * System PLL frequency while clock scaling is enabled, clk_sys runs from it
+ * undivided while frames are built, encrypted and parsed
+ */
+static uint32_t ClockHighKhz = 0;
+
+/*!
+ * System clock in use before clock scaling was enabled
+ */
+static uint32_t ClockDefaultKhz = 0;
+
+/*!
+ * Number of pending high clock requests
+ */
+static uint32_t ClockBoostCount = 0;
+
+#if USE_FREERTOS
+static void BoardUpdateSysTick( void )
+{
+    // SysTick counts clk_sys cycles, keep the FreeRTOS tick period
+    systick_hw->rvr = ( clock_get_hz( clk_sys ) / configTICK_RATE_HZ ) - 1;
+    systick_hw->cvr = 0;
+}
+#endif
+
+/*!
+ * Relocks the system PLL, only when clock scaling is enabled or disabled.
+ * While it is enabled clk_peri runs from the USB PLL, so the SPI and UART
+ * prescalers do not depend on the clk_sys divider.
+ */
+static void BoardSetSysPllKhz( uint32_t khz )
+{
+    // keep the radio IRQ handlers from using the SPI while its prescalers
+    // are stale
+    uint32_t mask = save_and_disable_interrupts( );
+
+    if( set_sys_clock_khz( khz, false ) )
+    {
+        if( ClockLowKhz != 0 )
+        {
+            clock_configure( clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB,
+                             clock_get_hz( clk_usb ), clock_get_hz( clk_usb ) );
+        }
+        else
+        {
+            clock_configure( clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLK_SYS,
+                             khz * KHZ, khz * KHZ );
+        }
+
+        SpiUpdateBaudrate( &SX1276.Spi );
+#if USE_FREERTOS
+        BoardUpdateSysTick( );
+#endif
+    }
+
+    restore_interrupts( mask );
+}
+
+/*!
+ * Divides the system PLL down to khz for clk_sys, the PLL keeps running so
+ * this is a divider write and not a relock
+ */
+static void BoardSetSysClockKhz( uint32_t khz )
+{
+    if( clock_get_hz( clk_sys ) == ( khz * KHZ ) )
+    {
+        return;
+    }
+
+    clock_configure( clk_sys, CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX,
+                     CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS,
+                     ClockHighKhz * KHZ, khz * KHZ );
+#if USE_FREERTOS
+    BoardUpdateSysTick( );
+#endif
+}
 
 void BoardInitMcu( void )
 {
@@ -62,4 +154,86 @@ void BoardCriticalSectionEnd( uint32_t *mask )
 
 void BoardResetMcu( void )
 {
+    // soft reset through the watchdog, the retained NVM cache is reused on
+    // the next boot
+    watchdog_reboot( 0, 0, 0 );
+
+    for( ;; )
+    {
+        tight_loop_contents( );
+    }
+}
+
+bool BoardSetClockScaling( uint32_t lowKhz, uint32_t highKhz )
+{
+    uint vco, postDiv1, postDiv2;
+    uint32_t mask;
+
+    if( lowKhz == 0 )
+    {
+        if( ClockLowKhz != 0 )
+        {
+            ClockLowKhz = 0;
+            ClockHighKhz = 0;
+            BoardSetSysPllKhz( ClockDefaultKhz );
+        }
+        return true;
+    }
+
+    // the idle clock is the PLL through the integer clk_sys divider
+    if( ( ( highKhz % lowKhz ) != 0 ) || !check_sys_clock_khz( highKhz, &vco, &postDiv1, &postDiv2 ) )
+    {
+        return false;
+    }
+
+    if( ClockLowKhz == 0 )
+    {
+        ClockDefaultKhz = clock_get_hz( clk_sys ) / KHZ;
+    }
+
+    bool relock = ( ClockLowKhz == 0 ) || ( ClockHighKhz != highKhz );
+
+    BoardCriticalSectionBegin( &mask );
+
+    ClockLowKhz = lowKhz;
+    ClockHighKhz = highKhz;
+
+    if( relock )
+    {
+        BoardSetSysPllKhz( highKhz );
+    }
+
+    BoardSetSysClockKhz( ( ClockBoostCount > 0 ) ? ClockHighKhz : ClockLowKhz );
+
+    BoardCriticalSectionEnd( &mask );
+
+    return true;
+}
+
+void BoardClockBoostBegin( void )
+{
+    uint32_t mask;
+
+    BoardCriticalSectionBegin( &mask );
+
+    if( ( ClockBoostCount++ == 0 ) && ( ClockLowKhz != 0 ) )
+    {
+        BoardSetSysClockKhz( ClockHighKhz );
+    }
+
+    BoardCriticalSectionEnd( &mask );
+}
+
+void BoardClockBoostEnd( void )
+{
+    uint32_t mask;
+
+    BoardCriticalSectionBegin( &mask );
+
+    if( ( ClockBoostCount > 0 ) && ( --ClockBoostCount == 0 ) && ( ClockLowKhz != 0 ) )
+    {
+        BoardSetSysClockKhz( ClockLowKhz );
+    }
+
+    BoardCriticalSectionEnd( &mask );
 }
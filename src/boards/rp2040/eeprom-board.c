@@ -5,47 +5,298 @@
  * 
  */
 
+#include <stdbool.h>
 #include <string.h>
 
 #include "pico/stdlib.h"
 #include "hardware/flash.h"
+#include "hardware/structs/watchdog.h"
 
 #include "utilities.h"
 #include "eeprom-board.h"
+#include "LoRaMac.h"
 
-#define EEPROM_SIZE    (FLASH_SECTOR_SIZE)
-#define EEPROM_OFFSET  (PICO_FLASH_SIZE_BYTES - EEPROM_SIZE)
-#define EEPROM_ADDRESS ((const uint8_t*)(XIP_BASE + EEPROM_OFFSET))
+// The NVM is kept in two copies in the last two flash sectors (see
+// LORAWAN_NVM_SECTORS in pico/lorawan.h), each ending with a header. A flush
+// erases and writes the older copy, and the header is written last, so a
+// power loss during a flush leaves the previous copy to mount.
+typedef struct {
+    uint32_t sequence;
+    uint32_t crc;
+} eeprom_header_t;
 
-static uint8_t eeprom_write_cache[EEPROM_SIZE];
+#define EEPROM_SIZE           (FLASH_SECTOR_SIZE - sizeof(eeprom_header_t))
+#define EEPROM_PAGES          (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define EEPROM_OFFSET(copy)   (PICO_FLASH_SIZE_BYTES - (2u - (copy)) * FLASH_SECTOR_SIZE)
+#define EEPROM_ADDRESS(copy)  ((const uint8_t*)(XIP_BASE + EEPROM_OFFSET(copy)))
+
+// Reads are served from the XIP mapped flash, only the pages written since
+// the last flush are held in RAM. By default there are enough slots for a
+// full store of the LoRaMac contexts and the page of library records, so a
+// store is never split over two flushes.
+#ifndef EEPROM_DIRTY_PAGES
+#define EEPROM_DIRTY_PAGES ((sizeof(LoRaMacNvmData_t) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE + 1)
+#endif
+
+#define EEPROM_PAGE_FREE 0xff
+
+// The dirty pages are kept in RAM that is not initialized on boot, the
+// watchdog scratch registers (which survive watchdog and soft resets but
+// are cleared on power-on) hold a magic number and CRC that validate them.
+// Scratch 4 - 7 are used by the boot ROM.
+#define EEPROM_RETAINED_MAGIC_SCRATCH 2
+#define EEPROM_RETAINED_CRC_SCRATCH   3
+#define EEPROM_RETAINED_MAGIC         0x45455052 // "EEPR"
+
+typedef struct {
+    uint8_t page[EEPROM_DIRTY_PAGES];
+    uint8_t data[EEPROM_DIRTY_PAGES][FLASH_PAGE_SIZE];
+} eeprom_dirty_pages_t;
+
+static eeprom_dirty_pages_t __uninitialized_ram(eeprom_dirty);
+
+static bool eeprom_warm_start = false;
+
+// mounted copy, the last sector also holds the NVM written before the copies
+// had headers
+static uint8_t eeprom_copy = 1;
+static uint32_t eeprom_sequence = 0;
+
+static uint8_t eeprom_page_buffer[FLASH_PAGE_SIZE];
+
+uint8_t EepromMcuFlush();
+
+static uint8_t* eeprom_dirty_page(uint16_t page)
+{
+    for (int i = 0; i < EEPROM_DIRTY_PAGES; i++) {
+        if (eeprom_dirty.page[i] == page) {
+            return eeprom_dirty.data[i];
+        }
+    }
+
+    return NULL;
+}
+
+static const uint8_t* eeprom_page(uint16_t page)
+{
+    const uint8_t* data = eeprom_dirty_page(page);
+
+    if (data == NULL) {
+        data = EEPROM_ADDRESS(eeprom_copy) + page * FLASH_PAGE_SIZE;
+    }
+
+    return data;
+}
+
+static uint8_t* eeprom_dirty_page_alloc(uint16_t page)
+{
+    uint8_t* data = eeprom_dirty_page(page);
+
+    if (data != NULL) {
+        return data;
+    }
+
+    for (int i = 0; i < EEPROM_DIRTY_PAGES; i++) {
+        if (eeprom_dirty.page[i] == EEPROM_PAGE_FREE) {
+            eeprom_dirty.page[i] = page;
+            memcpy(eeprom_dirty.data[i], EEPROM_ADDRESS(eeprom_copy) + page * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE);
+
+            return eeprom_dirty.data[i];
+        }
+    }
+
+    return NULL;
+}
+
+void EepromMcuRetain()
+{
+    watchdog_hw->scratch[EEPROM_RETAINED_CRC_SCRATCH] = Crc32((uint8_t*)&eeprom_dirty, sizeof(eeprom_dirty));
+    watchdog_hw->scratch[EEPROM_RETAINED_MAGIC_SCRATCH] = EEPROM_RETAINED_MAGIC;
+}
+
+static bool eeprom_copy_valid(uint8_t copy, uint32_t* sequence)
+{
+    const uint8_t* address = EEPROM_ADDRESS(copy);
+    eeprom_header_t header;
+
+    memcpy(&header, address + EEPROM_SIZE, sizeof(header));
+    *sequence = header.sequence;
+
+    return header.crc == Crc32((uint8_t*)address, EEPROM_SIZE + sizeof(header.sequence));
+}
+
+// Mounts the valid copy with the newest sequence number
+static void eeprom_mount(void)
+{
+    uint32_t sequence[2];
+    bool valid[2];
+
+    for (uint8_t copy = 0; copy < 2; copy++) {
+        valid[copy] = eeprom_copy_valid(copy, &sequence[copy]);
+    }
+
+    if (valid[0] && (!valid[1] || (int32_t)(sequence[0] - sequence[1]) > 0)) {
+        eeprom_copy = 0;
+    } else {
+        eeprom_copy = 1;
+    }
+
+    eeprom_sequence = valid[eeprom_copy] ? sequence[eeprom_copy] : 0;
+}
 
 void EepromMcuInit()
 {
-    memcpy(eeprom_write_cache, EEPROM_ADDRESS, sizeof(eeprom_write_cache));
+    eeprom_mount();
+
+    if (watchdog_hw->scratch[EEPROM_RETAINED_MAGIC_SCRATCH] == EEPROM_RETAINED_MAGIC &&
+        watchdog_hw->scratch[EEPROM_RETAINED_CRC_SCRATCH] == Crc32((uint8_t*)&eeprom_dirty, sizeof(eeprom_dirty))) {
+        // warm start, the dirty pages still hold the last stored contents
+        eeprom_warm_start = true;
+        return;
+    }
+
+    memset(&eeprom_dirty, 0, sizeof(eeprom_dirty));
+    memset(eeprom_dirty.page, EEPROM_PAGE_FREE, sizeof(eeprom_dirty.page));
+
+    EepromMcuRetain();
+}
+
+bool EepromMcuIsWarmStart()
+{
+    return eeprom_warm_start;
 }
 
 uint8_t EepromMcuReadBuffer( uint16_t addr, uint8_t *buffer, uint16_t size )
 {
-    memcpy(buffer, eeprom_write_cache + addr, size);
-    
+    if ((uint32_t)addr + size > EEPROM_SIZE) {
+        return FAIL;
+    }
+
+    while (size > 0) {
+        uint16_t page = addr / FLASH_PAGE_SIZE;
+        uint16_t offset = addr % FLASH_PAGE_SIZE;
+        uint16_t length = MIN(size, FLASH_PAGE_SIZE - offset);
+
+        memcpy(buffer, eeprom_page(page) + offset, length);
+
+        addr += length;
+        buffer += length;
+        size -= length;
+    }
+
     return SUCCESS;
 }
 
 uint8_t EepromMcuWriteBuffer( uint16_t addr, uint8_t *buffer, uint16_t size )
 {
-    memcpy(eeprom_write_cache + addr, buffer, size);
+    if ((uint32_t)addr + size > EEPROM_SIZE) {
+        return FAIL;
+    }
+
+    while (size > 0) {
+        uint16_t page = addr / FLASH_PAGE_SIZE;
+        uint16_t offset = addr % FLASH_PAGE_SIZE;
+        uint16_t length = MIN(size, FLASH_PAGE_SIZE - offset);
+
+        if (memcmp(eeprom_page(page) + offset, buffer, length) != 0) {
+            uint8_t* data = eeprom_dirty_page_alloc(page);
+
+            if (data == NULL) {
+                // out of dirty page slots (only with a smaller
+                // EEPROM_DIRTY_PAGES), write back what is pending
+                if (EepromMcuFlush() != SUCCESS) {
+                    return FAIL;
+                }
+
+                data = eeprom_dirty_page_alloc(page);
+            }
+
+            // the retained pages are only consistent again once the update
+            // is flushed
+            watchdog_hw->scratch[EEPROM_RETAINED_MAGIC_SCRATCH] = 0;
+
+            memcpy(data + offset, buffer, length);
+        }
+
+        addr += length;
+        buffer += length;
+        size -= length;
+    }
 
     return SUCCESS;
 }
 
-uint8_t EepromMcuFlush()
+// Each flash operation holds off interrupts on its own, as reads are
+// served from XIP
+static void eeprom_flash_erase(uint32_t offset)
 {
     uint32_t mask;
 
     BoardCriticalSectionBegin(&mask);
+    flash_range_erase(offset, FLASH_SECTOR_SIZE);
+    BoardCriticalSectionEnd(&mask);
+}
 
-    flash_range_erase(EEPROM_OFFSET, sizeof(eeprom_write_cache));
-    flash_range_program(EEPROM_OFFSET, eeprom_write_cache, sizeof(eeprom_write_cache));
+// Programs eeprom_page_buffer, the source pages may be in flash, which is
+// not readable while programming
+static void eeprom_flash_program_page(uint32_t offset)
+{
+    uint32_t mask;
 
+    BoardCriticalSectionBegin(&mask);
+    flash_range_program(offset, eeprom_page_buffer, FLASH_PAGE_SIZE);
     BoardCriticalSectionEnd(&mask);
 }
+
+uint8_t EepromMcuFlush()
+{
+    bool dirty = false;
+
+    for (int i = 0; i < EEPROM_DIRTY_PAGES; i++) {
+        dirty |= (eeprom_dirty.page[i] != EEPROM_PAGE_FREE);
+    }
+
+    if (!dirty) {
+        EepromMcuRetain();
+
+        return SUCCESS;
+    }
+
+    // the merged pages are written to the other copy, the header CRC is left
+    // erased and programmed last, once it can be computed from flash
+    uint8_t copy = eeprom_copy ^ 1;
+    eeprom_header_t header = {
+        .sequence = eeprom_sequence + 1,
+        .crc = 0xffffffff
+    };
+
+    eeprom_flash_erase(EEPROM_OFFSET(copy));
+
+    for (uint16_t page = 0; page < EEPROM_PAGES; page++) {
+        memcpy(eeprom_page_buffer, eeprom_page(page), FLASH_PAGE_SIZE);
+
+        if (page == EEPROM_PAGES - 1) {
+            memcpy(eeprom_page_buffer + FLASH_PAGE_SIZE - sizeof(header), &header, sizeof(header));
+        }
+
+        eeprom_flash_program_page(EEPROM_OFFSET(copy) + page * FLASH_PAGE_SIZE);
+    }
+
+    // programming only clears bits, so the erased bytes around the CRC are
+    // left as they are
+    header.crc = Crc32((uint8_t*)EEPROM_ADDRESS(copy), EEPROM_SIZE + sizeof(header.sequence));
+
+    memset(eeprom_page_buffer, 0xff, FLASH_PAGE_SIZE);
+    memcpy(eeprom_page_buffer + FLASH_PAGE_SIZE - sizeof(header.crc), &header.crc, sizeof(header.crc));
+    eeprom_flash_program_page(EEPROM_OFFSET(copy) + (EEPROM_PAGES - 1) * FLASH_PAGE_SIZE);
+
+    eeprom_copy = copy;
+    eeprom_sequence = header.sequence;
+
+    memset(&eeprom_dirty, 0, sizeof(eeprom_dirty));
+    memset(eeprom_dirty.page, EEPROM_PAGE_FREE, sizeof(eeprom_dirty.page));
+
+    EepromMcuRetain();
+
+    return SUCCESS;
+}
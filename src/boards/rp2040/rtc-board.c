@@ -7,6 +7,7 @@
 
 #include "pico/time.h"
 #include "pico/stdlib.h"
+#include "hardware/irq.h"
 
 #include "rtc-board.h"
 
@@ -14,6 +15,19 @@ static alarm_pool_t* rtc_alarm_pool = NULL;
 static absolute_time_t rtc_timer_context;
 static alarm_id_t last_rtc_alarm_id = -1;
 
+// Time reported to code outside of interrupts while a deferred radio event
+// is processed
+static volatile bool rtc_event_time_set = false;
+static uint32_t rtc_event_time;
+
+static bool rtc_alarm_irq_enabled;
+
+// The backup registers hold the SysTime offset from the calendar time. The
+// calendar time counts from boot and the timer is reset with the rest of the
+// chip, so they are kept in RAM and start from zero on every reset.
+static uint32_t rtc_bkup_data0;
+static uint32_t rtc_bkup_data1;
+
 void RtcInit( void )
 {
     rtc_alarm_pool = alarm_pool_create(2, 16);
@@ -32,8 +46,8 @@ uint32_t RtcGetCalendarTime( uint16_t *milliseconds )
 
 void RtcBkupRead( uint32_t *data0, uint32_t *data1 )
 {
-    *data0 = 0;
-    *data1 = 0;
+    *data0 = rtc_bkup_data0;
+    *data1 = rtc_bkup_data1;
 }
 
 uint32_t RtcGetTimerElapsedTime( void )
@@ -91,8 +105,40 @@ uint32_t RtcMs2Tick( TimerTime_t milliseconds )
     return milliseconds * 1000;
 }
 
+void RtcSetEventTime( uint32_t ticks )
+{
+    rtc_event_time = ticks;
+    rtc_event_time_set = true;
+}
+
+void RtcClearEventTime( void )
+{
+    rtc_event_time_set = false;
+}
+
+static uint rtc_alarm_irq( void )
+{
+    return TIMER_IRQ_0 + alarm_pool_hardware_alarm_num(rtc_alarm_pool);
+}
+
+void RtcAlarmIrqDisable( void )
+{
+    rtc_alarm_irq_enabled = irq_is_enabled(rtc_alarm_irq());
+
+    irq_set_enabled(rtc_alarm_irq(), false);
+}
+
+void RtcAlarmIrqEnable( void )
+{
+    irq_set_enabled(rtc_alarm_irq(), rtc_alarm_irq_enabled);
+}
+
 uint32_t RtcGetTimerValue( void )
 {
+    if (rtc_event_time_set && __get_current_exception() == 0) {
+        return rtc_event_time;
+    }
+
     uint64_t now = to_us_since_boot(get_absolute_time());
 
     return now;
@@ -105,6 +151,8 @@ TimerTime_t RtcTick2Ms( uint32_t tick )
 
 void RtcBkupWrite( uint32_t data0, uint32_t data1 )
 {
+    rtc_bkup_data0 = data0;
+    rtc_bkup_data1 = data1;
 }
 
 void RtcProcess( void )
@@ -10,9 +10,11 @@
 
 #include "spi-board.h"
 
+#define SPI_BAUDRATE (10 * 1000 * 1000)
+
 void SpiInit( Spi_t *obj, SpiId_t spiId, PinNames mosi, PinNames miso, PinNames sclk, PinNames nss )
 {
-    spi_init((spiId == 0) ? spi0 : spi1, 10 * 1000 * 1000);
+    spi_init((spiId == 0) ? spi0 : spi1, SPI_BAUDRATE);
     spi_set_format((spiId == 0) ? spi0 : spi1, 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
     gpio_set_function(mosi, GPIO_FUNC_SPI);
     gpio_set_function(miso, GPIO_FUNC_SPI);
@@ -30,3 +32,10 @@ uint16_t SpiInOut( Spi_t *obj, uint16_t outData )
 
     return inDataB;
 }
+
+void SpiUpdateBaudrate( Spi_t *obj )
+{
+    // the SPI prescalers are derived from clk_peri, recompute them after a
+    // system clock change
+    spi_set_baudrate((obj->SpiId == 0) ? spi0 : spi1, SPI_BAUDRATE);
+}
@@ -0,0 +1,21 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef __SX1276_BOARD_EVENTS_H__
+#define __SX1276_BOARD_EVENTS_H__
+
+#include <stdint.h>
+
+// Radio events reported with their time in µs, see SX1276SetEventCallback()
+#define RADIO_EVENT_TX_START 0
+#define RADIO_EVENT_TX_DONE  1
+#define RADIO_EVENT_RX_START 2
+#define RADIO_EVENT_RX_END   3
+
+void SX1276SetEventCallback( void ( *callback )( uint8_t event, uint32_t timestamp ) );
+
+#endif // __SX1276_BOARD_EVENTS_H__
@@ -28,12 +28,152 @@
 #include <stddef.h>
 
 #include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "pico/platform.h"
+
+#include "pico/time.h"
 
 #include "delay.h"
+#include "rtc-board.h"
+#include "utilities.h"
 #include "sx1276-board.h"
+#include "sx1276-board-events.h"
 
 #include "radio/radio.h"
 
+// DIO edges are only timestamped in the GPIO interrupt and queued, the
+// handlers (which do the SPI transfers) run from Radio.IrqProcess, called by
+// LmHandlerProcess. Must be a power of 2.
+#define DIO_EVENT_QUEUE_SIZE 16
+
+typedef struct {
+    uint8_t dio;
+    uint32_t timestamp;
+} dio_event_t;
+
+extern void RtcSetEventTime( uint32_t ticks );
+extern void RtcClearEventTime( void );
+extern void RtcAlarmIrqDisable( void );
+extern void RtcAlarmIrqEnable( void );
+
+static void SX1276IrqProcess( void );
+static void SX1276SendLbt( uint8_t *buffer, uint8_t size );
+static void SX1276SendNow( uint8_t *buffer, uint8_t size );
+static void SX1276LbtWait( void );
+static void SX1276SetRxTimed( uint32_t timeout );
+
+// Upper bound of a single CAD operation, it takes about 2 symbols
+#define LBT_CAD_TIMEOUT_MS 100
+
+#if LORAWAN_RADIO_TRACE
+// Radio events are recorded to a RAM ring, the oldest records are dropped
+// when it is full. Must be a power of 2.
+#ifndef LORAWAN_RADIO_TRACE_SIZE
+#define LORAWAN_RADIO_TRACE_SIZE 4096
+#endif
+
+// Record types, see lorawan_trace_read()
+#define TRACE_OP_MODE 1
+#define TRACE_TX      2
+#define TRACE_DIO     3
+#define TRACE_RX      4
+#define TRACE_RX_ERROR 5
+
+#define TRACE_HEADER_SIZE 7
+
+static uint8_t trace_ring[LORAWAN_RADIO_TRACE_SIZE];
+static uint32_t trace_head = 0;
+static uint32_t trace_tail = 0;
+
+static void trace_put(uint8_t byte)
+{
+    trace_ring[trace_head++ % LORAWAN_RADIO_TRACE_SIZE] = byte;
+}
+
+// size of the record at index, header included
+static uint32_t trace_record_size(uint32_t index)
+{
+    return TRACE_HEADER_SIZE + trace_ring[(index + 5) % LORAWAN_RADIO_TRACE_SIZE] +
+           (trace_ring[(index + 6) % LORAWAN_RADIO_TRACE_SIZE] << 8);
+}
+
+/*!
+ * \brief Records { uint32_t timestamp, uint8_t type, uint16_t length } and
+ *        the header and payload data, callable from interrupts
+ */
+static void trace_record(uint32_t timestamp, uint8_t type, const uint8_t* header, uint8_t header_size, const uint8_t* payload, uint8_t payload_size)
+{
+    uint16_t length = header_size + payload_size;
+    uint32_t size = TRACE_HEADER_SIZE + length;
+    uint32_t status = save_and_disable_interrupts();
+
+    while ((trace_head - trace_tail) + size > LORAWAN_RADIO_TRACE_SIZE) {
+        trace_tail += trace_record_size(trace_tail);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        trace_put(timestamp >> (8 * i));
+    }
+    trace_put(type);
+    trace_put(length);
+    trace_put(length >> 8);
+
+    for (uint32_t i = 0; i < length; i++) {
+        trace_put((i < header_size) ? header[i] : payload[i - header_size]);
+    }
+
+    restore_interrupts(status);
+}
+
+int SX1276TraceRead( uint8_t *buffer, uint32_t size )
+{
+    uint32_t copied = 0;
+    uint32_t status = save_and_disable_interrupts();
+
+    // whole records only
+    while (trace_tail != trace_head) {
+        uint32_t record = trace_record_size(trace_tail);
+
+        if (copied + record > size) {
+            break;
+        }
+
+        for (uint32_t i = 0; i < record; i++) {
+            buffer[copied++] = trace_ring[trace_tail++ % LORAWAN_RADIO_TRACE_SIZE];
+        }
+    }
+
+    restore_interrupts(status);
+
+    return copied;
+}
+
+static void trace_rx(uint8_t irq_flags)
+{
+    uint8_t header[3];
+    uint8_t payload[255];
+    uint8_t size = SX1276.Settings.LoRaPacketHandler.Size;
+
+    // the driver drops the frame without reading it, Size is the last frame's
+    if ((irq_flags & RFLR_IRQFLAGS_PAYLOADCRCERROR) != 0) {
+        trace_record(time_us_32(), TRACE_RX_ERROR, &irq_flags, 1, NULL, 0);
+        return;
+    }
+
+    header[0] = SX1276.Settings.LoRaPacketHandler.RssiValue;
+    header[1] = SX1276.Settings.LoRaPacketHandler.RssiValue >> 8;
+    header[2] = SX1276.Settings.LoRaPacketHandler.SnrValue;
+
+    // the radio is in standby after a single reception, the frame is still
+    // in its FIFO
+    SX1276Write( REG_LR_FIFOADDRPTR, SX1276Read( REG_LR_FIFORXCURRENTADDR ) );
+    SX1276ReadBuffer( REG_LR_FIFO, payload, size );
+
+    trace_record(time_us_32(), TRACE_RX, header, sizeof(header), payload, size);
+}
+#endif
+
 const struct Radio_s Radio =
 {
     SX1276Init,
@@ -46,10 +186,10 @@ const struct Radio_s Radio =
     SX1276SetTxConfig,
     SX1276CheckRfFrequency,
     SX1276GetTimeOnAir,
-    SX1276Send,
+    SX1276SendLbt,
     SX1276SetSleep,
     SX1276SetStby,
-    SX1276SetRx,
+    SX1276SetRxTimed,
     SX1276StartCad,
     SX1276SetTxContinuousWave,
     SX1276ReadRssi,
@@ -60,24 +200,298 @@ const struct Radio_s Radio =
     SX1276SetMaxPayloadLength,
     SX1276SetPublicNetwork,
     SX1276GetWakeupTime,
-    NULL, // void ( *IrqProcess )( void )
+    SX1276IrqProcess,
     NULL, // void ( *RxBoosted )( uint32_t timeout ) - SX126x Only
     NULL, // void ( *SetRxDutyCycle )( uint32_t rxTime, uint32_t sleepTime ) - SX126x Only
 };
 
 static DioIrqHandler** irq_handlers;
 
-void dio_gpio_callback(uint gpio, uint32_t events)
+static dio_event_t dio_events[DIO_EVENT_QUEUE_SIZE];
+static volatile uint32_t dio_events_head = 0; // written by the GPIO interrupt only
+static volatile uint32_t dio_events_tail = 0; // written by SX1276IrqProcess only
+
+static void ( *irq_notify )( void ) = NULL;
+static void ( *radio_event_callback )( uint8_t event, uint32_t timestamp ) = NULL;
+
+// Listen before talk, disabled when lbt_cad_count is 0
+static uint8_t lbt_cad_count = 0;
+static uint32_t lbt_backoff_min_ms;
+static uint32_t lbt_backoff_max_ms;
+static uint32_t lbt_max_delay_ms;
+
+// frame sent from interrupt context, LBT runs from SX1276IrqProcess instead
+static uint8_t* volatile lbt_pending_buffer = NULL;
+static uint8_t lbt_pending_size;
+
+static void dio_event_post(uint8_t dio)
+{
+    uint32_t head = dio_events_head;
+    uint32_t timestamp = RtcGetTimerValue();
+
+    if ((head - dio_events_tail) < DIO_EVENT_QUEUE_SIZE) {
+        dio_events[head % DIO_EVENT_QUEUE_SIZE].dio = dio;
+        dio_events[head % DIO_EVENT_QUEUE_SIZE].timestamp = timestamp;
+
+        __dmb();
+        dio_events_head = head + 1;
+    }
+
+#if LORAWAN_RADIO_TRACE
+    trace_record(timestamp, TRACE_DIO, &dio, 1, NULL, 0);
+#endif
+
+    if (irq_notify != NULL) {
+        irq_notify();
+    }
+}
+
+static void dio_raw_irq(uint8_t dio, Gpio_t* gpio)
+{
+    uint32_t events = gpio_get_irq_event_mask(gpio->pin);
+
+    if (events) {
+        gpio_acknowledge_irq(gpio->pin, events);
+
+        dio_event_post(dio);
+    }
+}
+
+static void dio0_raw_irq(void) { dio_raw_irq(0, &SX1276.DIO0); }
+static void dio1_raw_irq(void) { dio_raw_irq(1, &SX1276.DIO1); }
+static void dio2_raw_irq(void) { dio_raw_irq(2, &SX1276.DIO2); }
+static void dio3_raw_irq(void) { dio_raw_irq(3, &SX1276.DIO3); }
+static void dio4_raw_irq(void) { dio_raw_irq(4, &SX1276.DIO4); }
+static void dio5_raw_irq(void) { dio_raw_irq(5, &SX1276.DIO5); }
+
+static void dio_irq_init(uint8_t dio, Gpio_t* gpio, irq_handler_t handler, uint32_t events)
+{
+    // unused pins, and lines the driver has no handler for, stay polled
+    if (gpio->pin == NC || irq_handlers[dio] == NULL) {
+        return;
+    }
+
+    gpio_add_raw_irq_handler(gpio->pin, handler);
+    gpio_set_irq_enabled(gpio->pin, events, true);
+}
+
+void SX1276SetIrqNotify( void ( *notify )( void ) )
+{
+    irq_notify = notify;
+}
+
+void SX1276SetEventCallback( void ( *callback )( uint8_t event, uint32_t timestamp ) )
+{
+    radio_event_callback = callback;
+}
+
+static void radio_event(uint8_t event, uint32_t timestamp)
+{
+    if (radio_event_callback != NULL) {
+        radio_event_callback(event, timestamp);
+    }
+}
+
+static void SX1276IrqProcess( void )
+{
+    while (dio_events_tail != dio_events_head) {
+        __dmb();
+        dio_event_t event = dio_events[dio_events_tail % DIO_EVENT_QUEUE_SIZE];
+
+        // The handlers see the time of the edge, so the MAC schedules the
+        // RX windows and RX timestamps as if they had run in the interrupt.
+        // The radio timers also access the radio, keep them out meanwhile.
+        RtcAlarmIrqDisable();
+        RtcSetEventTime(event.timestamp);
+
+        bool rx_running = (SX1276.Settings.State == RF_RX_RUNNING);
+
+#if LORAWAN_RADIO_TRACE
+        // cleared by the driver's handler
+        uint8_t irq_flags = 0;
+
+        if (event.dio == 0 && rx_running && SX1276.Settings.Modem == MODEM_LORA) {
+            irq_flags = SX1276Read(REG_LR_IRQFLAGS);
+        }
+#endif
+
+        // TX done and RX done are signaled on DIO0, RX timeout on DIO1
+        if (event.dio == 0 && SX1276.Settings.State == RF_TX_RUNNING) {
+            radio_event(RADIO_EVENT_TX_DONE, event.timestamp);
+        } else if (event.dio <= 1 && rx_running) {
+            radio_event(RADIO_EVENT_RX_END, event.timestamp);
+        }
+
+        if (irq_handlers[event.dio] != NULL) {
+            irq_handlers[event.dio](NULL);
+        }
+
+#if LORAWAN_RADIO_TRACE
+        if (event.dio == 0 && rx_running && SX1276.Settings.Modem == MODEM_LORA) {
+            trace_rx(irq_flags);
+        }
+#endif
+
+        RtcClearEventTime();
+        RtcAlarmIrqEnable();
+
+        dio_events_tail++;
+    }
+
+    uint8_t* buffer = lbt_pending_buffer;
+
+    if (buffer != NULL) {
+        lbt_pending_buffer = NULL;
+
+        SX1276LbtWait();
+        SX1276SendNow(buffer, lbt_pending_size);
+    }
+}
+
+void SX1276SetLbt( uint8_t cadCount, uint32_t backoffMinMs, uint32_t backoffMaxMs, uint32_t maxDelayMs )
+{
+    lbt_cad_count = cadCount;
+    lbt_backoff_min_ms = backoffMinMs;
+    lbt_backoff_max_ms = backoffMaxMs;
+    lbt_max_delay_ms = maxDelayMs;
+}
+
+/*!
+ * \brief Runs channel activity detection on the configured channel, with
+ *        the modulation the next frame is sent with
+ *
+ * \retval busy True if a LoRa preamble was detected
+ */
+static bool SX1276CadBusy( uint32_t timeoutMs )
 {
-    if (gpio == SX1276.DIO0.pin) {
-        irq_handlers[0](NULL);
-    } else if (gpio == SX1276.DIO1.pin) {
-        irq_handlers[1](NULL);
+    uint32_t start = to_ms_since_boot(get_absolute_time());
+    uint8_t flags = 0;
+
+    // The flags are polled, only CAD events are unmasked
+    SX1276Write( REG_LR_IRQFLAGSMASK, RFLR_IRQFLAGS_RXTIMEOUT |
+                                      RFLR_IRQFLAGS_RXDONE |
+                                      RFLR_IRQFLAGS_PAYLOADCRCERROR |
+                                      RFLR_IRQFLAGS_VALIDHEADER |
+                                      RFLR_IRQFLAGS_TXDONE |
+                                      RFLR_IRQFLAGS_FHSSCHANGEDCHANNEL );
+    SX1276Write( REG_LR_IRQFLAGS, RFLR_IRQFLAGS_CADDONE | RFLR_IRQFLAGS_CADDETECTED );
+
+    SX1276SetOpMode( RFLR_OPMODE_CAD );
+
+    while( ( ( flags = SX1276Read( REG_LR_IRQFLAGS ) ) & RFLR_IRQFLAGS_CADDONE ) == 0 )
+    {
+        if( ( to_ms_since_boot(get_absolute_time()) - start ) > timeoutMs )
+        {
+            break;
+        }
     }
+
+    SX1276SetOpMode( RF_OPMODE_STANDBY );
+    SX1276Write( REG_LR_IRQFLAGS, RFLR_IRQFLAGS_CADDONE | RFLR_IRQFLAGS_CADDETECTED );
+
+    return ( flags & RFLR_IRQFLAGS_CADDETECTED ) != 0;
+}
+
+/*!
+ * \brief Waits until the channel is found free. A busy channel is retried
+ *        after a random backoff. Once the maximum delay, CAD included, is
+ *        used up the wait ends anyway, so the MAC TX scheduling is kept.
+ */
+static void SX1276LbtWait( void )
+{
+    uint32_t start = to_ms_since_boot(get_absolute_time());
+
+    for( ;; )
+    {
+        bool busy = false;
+
+        for( uint8_t i = 0; ( i < lbt_cad_count ) && !busy; i++ )
+        {
+            uint32_t elapsed = to_ms_since_boot(get_absolute_time()) - start;
+
+            if( elapsed >= lbt_max_delay_ms )
+            {
+                return;
+            }
+
+            busy = SX1276CadBusy( MIN( LBT_CAD_TIMEOUT_MS, lbt_max_delay_ms - elapsed ) );
+        }
+
+        if( !busy )
+        {
+            return;
+        }
+
+        uint32_t elapsed = to_ms_since_boot(get_absolute_time()) - start;
+        uint32_t backoff = randr( lbt_backoff_min_ms, lbt_backoff_max_ms );
+
+        if( elapsed + backoff > lbt_max_delay_ms )
+        {
+            return;
+        }
+
+        DelayMs( backoff );
+    }
+}
+
+static void SX1276SendNow( uint8_t *buffer, uint8_t size )
+{
+#if LORAWAN_RADIO_TRACE
+    trace_record(time_us_32(), TRACE_TX, NULL, 0, buffer, size);
+#endif
+
+    radio_event(RADIO_EVENT_TX_START, time_us_32());
+
+    SX1276Send( buffer, size );
+}
+
+/*!
+ * \brief Sends the frame once the channel is found free.
+ *
+ * \remark The MAC also sends from its TX delay timer, in the alarm
+ *         interrupt. CAD and backoff would block interrupts for up to the
+ *         maximum delay there, so the frame is handed to SX1276IrqProcess
+ *         and sent from the MAC processing instead. The frame buffer is the
+ *         MAC's and stays valid until TX done.
+ */
+static void SX1276SendLbt( uint8_t *buffer, uint8_t size )
+{
+    if( ( lbt_cad_count > 0 ) && ( SX1276.Settings.Modem == MODEM_LORA ) )
+    {
+        if( __get_current_exception( ) == 0 )
+        {
+            SX1276LbtWait( );
+        }
+        else if( irq_notify != NULL )
+        {
+            lbt_pending_size = size;
+            lbt_pending_buffer = buffer;
+
+            irq_notify( );
+            return;
+        }
+    }
+
+    SX1276SendNow( buffer, size );
+}
+
+static void SX1276SetRxTimed( uint32_t timeout )
+{
+    radio_event(RADIO_EVENT_RX_START, time_us_32());
+
+    SX1276SetRx( timeout );
 }
 
 void SX1276SetAntSwLowPower( bool status )
 {
+#if LORAWAN_RADIO_TRACE
+    // called with true when the radio goes to sleep
+    if (status) {
+        uint8_t opMode = RF_OPMODE_SLEEP;
+
+        trace_record(time_us_32(), TRACE_OP_MODE, &opMode, 1, NULL, 0);
+    }
+#endif
 }
 
 bool SX1276CheckRfFrequency( uint32_t frequency )
@@ -96,6 +510,10 @@ uint32_t SX1276GetDio1PinState( void )
 
 void SX1276SetAntSw( uint8_t opMode )
 {
+#if LORAWAN_RADIO_TRACE
+    // called on every op mode change but sleep
+    trace_record(time_us_32(), TRACE_OP_MODE, &opMode, 1, NULL, 0);
+#endif
 }
 
 void SX1276Reset( void )
@@ -116,14 +534,25 @@ void SX1276IoInit( void )
 
     GpioInit( &SX1276.DIO0, SX1276.DIO0.pin, PIN_INPUT, PIN_PUSH_PULL, PIN_PULL_UP, 0 );        // IRQ / DIO0
     GpioInit( &SX1276.DIO1, SX1276.DIO1.pin, PIN_INPUT, PIN_PUSH_PULL, PIN_PULL_UP, 0 );        // DI01
+    GpioInit( &SX1276.DIO2, SX1276.DIO2.pin, PIN_INPUT, PIN_PUSH_PULL, PIN_PULL_UP, 0 );        // DIO2
+    GpioInit( &SX1276.DIO3, SX1276.DIO3.pin, PIN_INPUT, PIN_PUSH_PULL, PIN_PULL_UP, 0 );        // DIO3
+    GpioInit( &SX1276.DIO4, SX1276.DIO4.pin, PIN_INPUT, PIN_PUSH_PULL, PIN_PULL_UP, 0 );        // DIO4
+    GpioInit( &SX1276.DIO5, SX1276.DIO5.pin, PIN_INPUT, PIN_PUSH_PULL, PIN_PULL_UP, 0 );        // DIO5
 }
 
 void SX1276IoIrqInit( DioIrqHandler **irqHandlers )
 {
     irq_handlers = irqHandlers;
 
-    gpio_set_irq_enabled_with_callback(SX1276.DIO0.pin, GPIO_IRQ_EDGE_RISE, true, &dio_gpio_callback);
-    gpio_set_irq_enabled_with_callback(SX1276.DIO1.pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, &dio_gpio_callback);
+    // Each DIO line gets its own raw handler on the shared GPIO interrupt
+    dio_irq_init(0, &SX1276.DIO0, dio0_raw_irq, GPIO_IRQ_EDGE_RISE);
+    dio_irq_init(1, &SX1276.DIO1, dio1_raw_irq, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL);
+    dio_irq_init(2, &SX1276.DIO2, dio2_raw_irq, GPIO_IRQ_EDGE_RISE);
+    dio_irq_init(3, &SX1276.DIO3, dio3_raw_irq, GPIO_IRQ_EDGE_RISE);
+    dio_irq_init(4, &SX1276.DIO4, dio4_raw_irq, GPIO_IRQ_EDGE_RISE);
+    dio_irq_init(5, &SX1276.DIO5, dio5_raw_irq, GPIO_IRQ_EDGE_RISE);
+
+    irq_set_enabled(IO_IRQ_BANK0, true);
 }
 
 /*!
@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+// Replacement for LoRaMac-node's FragDecoder.c, built in its place with
+// LORAWAN_FRAG_DECODER_WORDS. It takes the same steps as the reference
+// decoder (test/frag_decoder checks this fragment by fragment), but on
+// packed 32-bit words: parity matrix rows and M2B matrix lines are bit
+// vectors, fragment data is XORed a word at a time, and the fragment of a
+// lost index is looked up directly rather than searched for.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "FragDecoder.h"
+
+#if( FRAG_DECODER_FILE_HANDLING_NEW_API != 1 )
+#error "frag_decoder.c only implements the FRAG_DECODER_FILE_HANDLING_NEW_API interface"
+#endif
+
+#define FRAG_BIT_WORDS( bits )      ( ( ( bits ) + 31 ) / 32 )
+#define FRAG_DATA_WORDS             ( ( FRAG_MAX_SIZE + 3 ) / 4 )
+
+typedef struct
+{
+    FragDecoderCallbacks_t* Callbacks;
+    uint16_t FragNb;
+    uint8_t FragSize;
+    uint32_t M2BLine;
+    // 1 based lost index of each fragment, 0 once received
+    uint16_t FragNbMissingIndex[FRAG_MAX_NB];
+    // fragment of each lost index
+    uint16_t MissingFrag[FRAG_MAX_REDUNDANCY];
+    // line i has its first one in column i, once bit i of S is set
+    uint32_t MatrixM2B[FRAG_MAX_REDUNDANCY][FRAG_BIT_WORDS( FRAG_MAX_REDUNDANCY )];
+    uint32_t S[FRAG_BIT_WORDS( FRAG_MAX_REDUNDANCY )];
+    FragDecoderStatus_t Status;
+}FragDecoder_t;
+
+static FragDecoder_t FragDecoder;
+
+static void FragWrite( uint32_t index, const uint32_t* data )
+{
+    FragDecoder.Callbacks->FragDecoderWrite( index * FragDecoder.FragSize, ( uint8_t* )data, FragDecoder.FragSize );
+}
+
+static void FragRead( uint32_t index, uint32_t* data )
+{
+    FragDecoder.Callbacks->FragDecoderRead( index * FragDecoder.FragSize, ( uint8_t* )data, FragDecoder.FragSize );
+}
+
+static void XorWords( uint32_t* dst, const uint32_t* src, uint32_t words )
+{
+    for( uint32_t i = 0; i < words; i++ )
+    {
+        dst[i] ^= src[i];
+    }
+}
+
+static bool GetBit( const uint32_t* vector, uint32_t bit )
+{
+    return ( vector[bit >> 5] >> ( bit & 31 ) ) & 1;
+}
+
+static void SetBit( uint32_t* vector, uint32_t bit )
+{
+    vector[bit >> 5] |= 1u << ( bit & 31 );
+}
+
+/*!
+ * First set bit of a vector of size bits, -1 if none
+ */
+static int32_t FindFirstOne( const uint32_t* vector, uint32_t size )
+{
+    for( uint32_t w = 0; w < FRAG_BIT_WORDS( size ); w++ )
+    {
+        if( vector[w] != 0 )
+        {
+            return ( w << 5 ) + __builtin_ctz( vector[w] );
+        }
+    }
+
+    return -1;
+}
+
+static uint32_t FragPrbs23( uint32_t value )
+{
+    uint32_t b0 = value & 0x01;
+    uint32_t b1 = ( value & 0x20 ) >> 5;
+
+    return ( value >> 1 ) + ( ( b0 ^ b1 ) << 22 );
+}
+
+/*!
+ * Row n of the parity matrix over m fragments, as defined by the fragmented
+ * data block transport specification
+ */
+static void FragGetParityMatrixRow( uint32_t n, uint32_t m, uint32_t* row )
+{
+    uint32_t mTemp = ( ( m & ( m - 1 ) ) == 0 ) ? 1 : 0;
+    uint32_t x = 1 + ( 1001 * n );
+    uint32_t nbCoeff = 0;
+
+    memset( row, 0, FRAG_BIT_WORDS( m ) * sizeof( uint32_t ) );
+
+    while( nbCoeff < ( m >> 1 ) )
+    {
+        uint32_t r = 1 << 16;
+
+        while( r >= m )
+        {
+            x = FragPrbs23( x );
+            r = x % ( m + mTemp );
+        }
+        SetBit( row, r );
+        nbCoeff++;
+    }
+}
+
+/*!
+ * Numbers the fragments skipped before counter as lost
+ */
+static void FragFindMissingFrags( uint16_t counter )
+{
+    int32_t i = FragDecoder.Status.FragNbLastRx;
+    int32_t end = counter - 1;
+
+    for( ; ( i < end ) && ( i < FragDecoder.FragNb ); i++ )
+    {
+        FragDecoder.Status.FragNbLost++;
+        FragDecoder.FragNbMissingIndex[i] = FragDecoder.Status.FragNbLost;
+
+        if( FragDecoder.Status.FragNbLost <= FRAG_MAX_REDUNDANCY )
+        {
+            FragDecoder.MissingFrag[FragDecoder.Status.FragNbLost - 1] = i;
+        }
+    }
+
+    // the reference walks on to counter - 1 without numbering any fragment
+    if( i < end )
+    {
+        i = end;
+    }
+
+    if( i < FragDecoder.FragNb )
+    {
+        FragDecoder.Status.FragNbLastRx = counter;
+    }
+    else
+    {
+        FragDecoder.Status.FragNbLastRx = FragDecoder.FragNb + 1;
+    }
+}
+
+void FragDecoderInit( uint16_t fragNb, uint8_t fragSize, FragDecoderCallbacks_t* callbacks )
+{
+    uint32_t erased[FRAG_DATA_WORDS];
+
+    FragDecoder.Callbacks = callbacks;
+    FragDecoder.FragNb = fragNb;
+    FragDecoder.FragSize = fragSize;
+    FragDecoder.M2BLine = 0;
+
+    memset( &FragDecoder.Status, 0, sizeof( FragDecoder.Status ) );
+    memset( FragDecoder.FragNbMissingIndex, 0, sizeof( FragDecoder.FragNbMissingIndex ) );
+    memset( FragDecoder.MatrixM2B, 0, sizeof( FragDecoder.MatrixM2B ) );
+    memset( FragDecoder.S, 0, sizeof( FragDecoder.S ) );
+
+    // the file starts out erased, a fragment at a time
+    memset( erased, 0xFF, sizeof( erased ) );
+
+    for( uint32_t i = 0; i < fragNb; i++ )
+    {
+        FragWrite( i, erased );
+    }
+}
+
+uint32_t FragDecoderGetMaxFileSize( void )
+{
+    return FRAG_MAX_NB * FRAG_MAX_SIZE;
+}
+
+int32_t FragDecoderProcess( uint16_t fragCounter, uint8_t* rawData )
+{
+    uint32_t data[FRAG_DATA_WORDS] = { 0 };
+    uint32_t temp[FRAG_DATA_WORDS] = { 0 };
+    uint32_t row[FRAG_BIT_WORDS( FRAG_MAX_NB )];
+    uint32_t vector[FRAG_BIT_WORDS( FRAG_MAX_REDUNDANCY )] = { 0 };
+    uint32_t dataWords = ( FragDecoder.FragSize + 3 ) / 4;
+    uint32_t lost;
+    int32_t first;
+    bool noInfo = false;
+
+    FragDecoder.Status.FragNbRx = fragCounter;
+
+    if( ( fragCounter == 0 ) || ( fragCounter < FragDecoder.Status.FragNbLastRx ) )
+    {
+        return FRAG_SESSION_ONGOING; // Drop frame out of order
+    }
+
+    memcpy( data, rawData, FragDecoder.FragSize );
+
+    // The FragNb first fragments are not encoded
+    if( fragCounter <= FragDecoder.FragNb )
+    {
+        FragWrite( fragCounter - 1, data );
+
+        FragDecoder.FragNbMissingIndex[fragCounter - 1] = 0;
+
+        FragFindMissingFrags( fragCounter );
+
+        if( ( fragCounter == FragDecoder.FragNb ) && ( FragDecoder.Status.FragNbLost == 0 ) )
+        {
+            return FRAG_SESSION_FINISHED;
+        }
+
+        return FRAG_SESSION_ONGOING;
+    }
+
+    if( FragDecoder.Status.FragNbLost > FRAG_MAX_REDUNDANCY )
+    {
+        FragDecoder.Status.MatrixError = 1;
+        return FRAG_SESSION_FINISHED;
+    }
+
+    // In case of the end of true data is missing
+    FragFindMissingFrags( fragCounter );
+
+    // checked again here, unlike the reference, as the fragments lost at the
+    // end would not fit in the M2B matrix
+    if( FragDecoder.Status.FragNbLost > FRAG_MAX_REDUNDANCY )
+    {
+        FragDecoder.Status.MatrixError = 1;
+        return FRAG_SESSION_FINISHED;
+    }
+
+    lost = FragDecoder.Status.FragNbLost;
+
+    if( lost == 0 )
+    {
+        return FRAG_SESSION_FINISHED;
+    }
+
+    // XOR the received fragments of the parity row into the data, the lost
+    // ones make up the M2B line
+    FragGetParityMatrixRow( fragCounter - FragDecoder.FragNb, FragDecoder.FragNb, row );
+
+    for( uint32_t w = 0; w < FRAG_BIT_WORDS( FragDecoder.FragNb ); w++ )
+    {
+        uint32_t bits = row[w];
+
+        while( bits != 0 )
+        {
+            uint32_t i = ( w << 5 ) + __builtin_ctz( bits );
+
+            bits &= bits - 1;
+
+            if( FragDecoder.FragNbMissingIndex[i] == 0 )
+            {
+                FragRead( i, temp );
+                XorWords( data, temp, dataWords );
+            }
+            else
+            {
+                SetBit( vector, FragDecoder.FragNbMissingIndex[i] - 1 );
+            }
+        }
+    }
+
+    first = FindFirstOne( vector, lost );
+
+    if( first < 0 )
+    {
+        return FRAG_SESSION_ONGOING;
+    }
+
+    // reduce the line by the lines already in the matrix
+    while( GetBit( FragDecoder.S, first ) )
+    {
+        XorWords( vector, FragDecoder.MatrixM2B[first], FRAG_BIT_WORDS( lost ) );
+        FragRead( FragDecoder.MissingFrag[first], temp );
+        XorWords( data, temp, dataWords );
+
+        first = FindFirstOne( vector, lost );
+
+        if( first < 0 )
+        {
+            noInfo = true;
+            break;
+        }
+    }
+
+    if( !noInfo )
+    {
+        memcpy( FragDecoder.MatrixM2B[first], vector, sizeof( vector ) );
+        FragWrite( FragDecoder.MissingFrag[first], data );
+        SetBit( FragDecoder.S, first );
+        FragDecoder.M2BLine++;
+    }
+
+    if( FragDecoder.M2BLine < lost )
+    {
+        return FRAG_SESSION_ONGOING;
+    }
+
+    // The matrix is triangular, back substitute from the last line, where
+    // lines below i are already reduced to their diagonal one
+    for( int32_t i = lost - 2; i >= 0; i-- )
+    {
+        uint32_t* line = FragDecoder.MatrixM2B[i];
+        bool changed = false;
+
+        FragRead( FragDecoder.MissingFrag[i], data );
+
+        for( uint32_t w = i >> 5; w < FRAG_BIT_WORDS( lost ); w++ )
+        {
+            uint32_t bits = line[w];
+
+            if( w == ( uint32_t )( i >> 5 ) )
+            {
+                bits &= ~( ( 2u << ( i & 31 ) ) - 1 );
+            }
+
+            while( bits != 0 )
+            {
+                uint32_t j = ( w << 5 ) + __builtin_ctz( bits );
+
+                bits &= bits - 1;
+
+                FragRead( FragDecoder.MissingFrag[j], temp );
+                XorWords( data, temp, dataWords );
+                changed = true;
+            }
+        }
+
+        memset( line, 0, sizeof( FragDecoder.MatrixM2B[i] ) );
+        SetBit( line, i );
+
+        if( changed )
+        {
+            FragWrite( FragDecoder.MissingFrag[i], data );
+        }
+    }
+
+    return lost;
+}
+
+FragDecoderStatus_t FragDecoderGetStatus( void )
+{
+    return FragDecoder.Status;
+}
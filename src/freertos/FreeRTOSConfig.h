@@ -3,6 +3,10 @@
 
 #include <assert.h>
 
+#ifndef __ASSEMBLER__
+#include "hardware/clocks.h"
+#endif
+
 /* Use Pico SDK ISR handlers */
 #define vPortSVCHandler isr_svcall
 #define xPortPendSVHandler isr_pendsv
@@ -11,7 +15,8 @@
 #define configUSE_PREEMPTION                    1
 #define configUSE_PORT_OPTIMISED_TASK_SELECTION 0
 #define configUSE_TICKLESS_IDLE                 0
-#define configCPU_CLOCK_HZ                      133000000
+/* Read at scheduler start, clk_sys may be scaled by lorawan_set_clock_scaling */
+#define configCPU_CLOCK_HZ                      ( clock_get_hz( clk_sys ) )
 #define configTICK_RATE_HZ                      ( ( TickType_t ) 1000 )
 #define configMAX_PRIORITIES                    32
 #define configMINIMAL_STACK_SIZE                256
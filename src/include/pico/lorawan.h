@@ -28,6 +28,12 @@ struct lorawan_sx1276_settings {
     uint reset;
     uint dio0;
     uint dio1;
+    uint dio2;
+    uint dio3;
+    uint dio4;
+    uint dio5;
+    // DIO2 - DIO5 are only used when their bit (1 << n) is set
+    uint32_t dio_mask;
 };
 
 struct lorawan_abp_settings {
@@ -44,6 +50,135 @@ struct lorawan_otaa_settings {
     const char* channel_mask;
 };
 
+struct lorawan_join_settings {
+    // US915 sub-bands (1 - 8) to try in order, NULL tries all sub-bands
+    const uint8_t* sub_bands;
+    uint8_t num_sub_bands;
+
+    // data rates to try on each sub-band, NULL uses the default data rate
+    const int8_t* datarates;
+    uint8_t num_datarates;
+
+    // delay between join attempts, doubled after each full rotation of
+    // the sub-bands and data rates up to backoff_max_ms
+    uint32_t backoff_min_ms;
+    uint32_t backoff_max_ms;
+};
+
+struct lorawan_lbt_settings {
+    // consecutive CAD operations (about 2 symbols each) that must all find
+    // the channel free
+    uint8_t cad_count;
+
+    // random delay before retrying a busy channel
+    uint32_t backoff_min_ms;
+    uint32_t backoff_max_ms;
+
+    // upper bound of the delay added to an uplink, it is sent anyway once
+    // the next backoff would exceed it
+    uint32_t max_delay_ms;
+};
+
+// µs timestamps (time_us_32()) of the last uplink, 0 if the step did not
+// happen (yet)
+struct lorawan_timeline {
+    uint32_t send_entry_us;
+    uint32_t send_accept_us;
+    uint32_t tx_start_us;
+    uint32_t tx_done_us;
+    uint32_t rx1_open_us;
+    uint32_t rx1_close_us;
+    uint32_t rx2_open_us;
+    uint32_t rx2_close_us;
+    uint32_t mcps_confirm_us;
+    uint32_t nvm_flush_start_us;
+    uint32_t nvm_flush_end_us;
+};
+
+// flash sectors at the end of flash used for NVM, two copies written in
+// turn
+#define LORAWAN_NVM_SECTORS 2
+
+enum lorawan_class {
+    LORAWAN_CLASS_A = 0,
+    LORAWAN_CLASS_B = 1,
+    LORAWAN_CLASS_C = 2,
+};
+
+// number of downlink ports counted separately by struct lorawan_stats
+#define LORAWAN_STATS_PORTS 16
+
+struct lorawan_stats {
+    // uplinks completed by the MAC, and those sent as confirmed
+    uint32_t uplinks;
+    uint32_t confirmed_uplinks;
+    uint32_t acks;
+
+    // transmissions beyond the first of an uplink (NbTrans, confirmed retries)
+    uint32_t retransmissions;
+
+    // downlinks by FPort, the last entry counts all ports from
+    // LORAWAN_STATS_PORTS - 1 on, port 0 carries MAC commands only
+    uint32_t downlinks;
+    uint32_t downlinks_by_port[LORAWAN_STATS_PORTS];
+
+    // downlinks dropped because the receive queue was full, and the time
+    // from the radio receiving a downlink to lorawan_receive() returning it
+    uint32_t downlinks_dropped;
+    uint32_t downlink_latency_us_last;
+    uint32_t downlink_latency_us_max;
+
+    uint32_t join_attempts;
+    uint32_t joins;
+
+    // requests delayed by the duty cycle, and the total delay
+    uint32_t duty_cycle_deferrals;
+    uint32_t duty_cycle_deferred_ms;
+
+    // time on air of all transmissions
+    uint32_t airtime_ms;
+
+    // of the downlinks received, 0 if none
+    int16_t rssi_min;
+    int16_t rssi_avg;
+    int16_t rssi_max;
+    int8_t snr_min;
+    int8_t snr_avg;
+    int8_t snr_max;
+};
+
+// number of US915 uplink channels, 0 - 63 are 125 kHz, 64 - 71 500 kHz
+#define LORAWAN_CHANNELS 72
+
+struct lorawan_channel_stats {
+    // confirmed uplinks sent on the channel and acknowledged
+    uint32_t uplinks;
+    uint32_t acks;
+
+    // moving average of the downlinks received after uplinks on the channel
+    int16_t rssi;
+    int8_t snr;
+
+    // removed from the channel mask by adaptive channel masking
+    bool excluded;
+};
+
+struct lorawan_adaptive_channels_settings {
+    // confirmed uplinks on a channel before its ACK ratio is judged
+    uint16_t min_uplinks;
+
+    // channels acknowledged less often are excluded from the channel mask
+    uint8_t min_ack_percent;
+
+    // uplinks after which the excluded channels are probed again
+    uint16_t reprobe_uplinks;
+};
+
+struct lorawan_nvm_stats {
+    uint32_t uplinks;
+    uint32_t flash_writes;
+};
+
 const char* lorawan_default_dev_eui(char* dev_eui);
 
 int lorawan_init(const struct lorawan_sx1276_settings* sx1276_settings, LoRaMacRegion_t region);
@@ -52,8 +187,12 @@ int lorawan_init_abp(const struct lorawan_sx1276_settings* sx1276_settings, LoRa
 
 int lorawan_init_otaa(const struct lorawan_sx1276_settings* sx1276_settings, LoRaMacRegion_t region, const struct lorawan_otaa_settings* otaa_settings);
 
+int lorawan_set_join_settings(const struct lorawan_join_settings* join_settings);
+
 int lorawan_join();
 
+int lorawan_join_wait(uint32_t timeout_ms);
+
 int lorawan_is_joined();
 
 int lorawan_process();
@@ -68,10 +207,38 @@ int lorawan_send_confirmed_wait(const void* data, uint8_t data_len, uint8_t app_
 
 int lorawan_receive(void* data, uint8_t data_len, uint8_t* app_port);
 
+int lorawan_request_class(enum lorawan_class device_class);
+
+int lorawan_get_class();
+
 void lorawan_debug(bool debug);
 
 int lorawan_set_confirmed_retry_count(uint8_t retry_count);
 
+int lorawan_set_clock_scaling(uint32_t low_khz, uint32_t high_khz);
+
+int lorawan_set_lbt(const struct lorawan_lbt_settings* lbt_settings);
+
+int lorawan_set_fcnt_persist_interval(uint16_t interval);
+
+int lorawan_trace_read(void* buffer, size_t size);
+
+int lorawan_get_last_timeline(struct lorawan_timeline* timeline);
+
+int lorawan_get_stats(struct lorawan_stats* stats);
+
+int32_t lorawan_next_tx_in_ms();
+
+int32_t lorawan_time_on_air(uint8_t len, int8_t dr);
+
+int lorawan_max_payload_now();
+
+int lorawan_get_channel_stats(uint8_t channel, struct lorawan_channel_stats* channel_stats);
+
+int lorawan_set_adaptive_channels(const struct lorawan_adaptive_channels_settings* settings);
+
+int lorawan_get_nvm_stats(struct lorawan_nvm_stats* nvm_stats);
+
 int lorawan_erase_nvm();
 
 // Diagnostics / accessors
@@ -79,6 +246,8 @@ int lorawan_erase_nvm();
 int lorawan_get_devaddr(uint32_t* devaddr);
 // Gets current ADR enabled state from the MAC (1 enabled, 0 disabled); returns 0 on success
 int lorawan_get_adr_enabled(int* adr_enabled);
+// Gets the current uplink data rate from the MAC; returns 0 on success
+int lorawan_get_datarate(int8_t* datarate);
 // Returns 1 if the last confirmed uplink was acknowledged, else 0
 int lorawan_last_ack_received(void);
 
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+#ifndef _PICO_LORAWAN_AGGREGATE_H_
+#define _PICO_LORAWAN_AGGREGATE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// record types are 4 bits, record data 1 - 16 bytes
+#define LORAWAN_AGGREGATE_MAX_TYPE 15
+#define LORAWAN_AGGREGATE_MAX_RECORD_SIZE 16
+
+struct lorawan_aggregate_settings {
+    uint8_t app_port;
+    bool confirmed;
+
+    // longest time a record is held before the frame is sent
+    uint32_t max_latency_ms;
+};
+
+struct lorawan_aggregate_stats {
+    uint32_t records;
+    uint32_t uplinks;
+    uint32_t airtime_ms;
+};
+
+int lorawan_aggregate_init(const struct lorawan_aggregate_settings* settings);
+
+int lorawan_aggregate_append(uint8_t type, const void* data, uint8_t len, bool priority);
+
+int lorawan_aggregate_process();
+
+int lorawan_aggregate_flush();
+
+int lorawan_aggregate_get_stats(struct lorawan_aggregate_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
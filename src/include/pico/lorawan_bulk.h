@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+#ifndef _PICO_LORAWAN_BULK_H_
+#define _PICO_LORAWAN_BULK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// fragment header: transfer id, parity group, index (bit 15 set for parity), object size
+#define LORAWAN_BULK_HEADER_SIZE 6
+#define LORAWAN_BULK_PARITY_FLAG 0x8000
+#define LORAWAN_BULK_MAX_FRAGMENTS 1024
+
+struct lorawan_bulk_settings {
+    uint8_t app_port;
+
+    // send one XOR parity fragment after every parity_group data fragments, 0 for none
+    uint8_t parity_group;
+
+    // minimum time between fragments, to leave duty cycle for other uplinks
+    uint32_t interval_ms;
+
+    void (*progress)(uint16_t sent, uint16_t total, void* context);
+    void (*complete)(int result, void* context);
+    void* context;
+};
+
+int lorawan_bulk_send(const struct lorawan_bulk_settings* settings, const void* data, uint16_t size);
+
+int lorawan_bulk_process();
+
+bool lorawan_bulk_busy();
+
+void lorawan_bulk_cancel();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+#ifndef _PICO_LORAWAN_CODEC_H_
+#define _PICO_LORAWAN_CODEC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LORAWAN_CODEC_MAX_CHANNELS 16
+
+enum lorawan_codec_encoding {
+    // zig-zag varint of the value
+    LORAWAN_CODEC_VARINT = 0,
+    // zig-zag varint of the change from the previous frame, the value in keyframes
+    LORAWAN_CODEC_DELTA = 1,
+    // value - min packed in bits
+    LORAWAN_CODEC_FIXED = 2,
+};
+
+struct lorawan_codec_channel {
+    uint8_t encoding;
+
+    // LORAWAN_CODEC_FIXED only
+    uint8_t bits;
+    int32_t min;
+};
+
+struct lorawan_codec {
+    const struct lorawan_codec_channel* channels;
+    uint8_t channel_count;
+    uint8_t keyframe_interval;
+
+    uint8_t sequence;
+    uint8_t frames_since_keyframe;
+    bool synced;
+    int32_t previous[LORAWAN_CODEC_MAX_CHANNELS];
+};
+
+int lorawan_codec_init(struct lorawan_codec* codec, const struct lorawan_codec_channel* channels, uint8_t channel_count, uint8_t keyframe_interval);
+
+void lorawan_codec_force_keyframe(struct lorawan_codec* codec);
+
+int lorawan_codec_encode(struct lorawan_codec* codec, const int32_t* values, uint8_t* buffer, uint8_t buffer_len);
+
+int lorawan_codec_decode(struct lorawan_codec* codec, const uint8_t* buffer, uint8_t len, int32_t* values);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+#ifndef _PICO_LORAWAN_FUOTA_H_
+#define _PICO_LORAWAN_FUOTA_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "pico/lorawan_queue.h"
+
+// size of the flash region below the queue that fragmented downlinks are
+// written to, it holds the image and the decoder's parity fragments
+#ifndef LORAWAN_FUOTA_STORE_SIZE
+#define LORAWAN_FUOTA_STORE_SIZE (256 * 1024)
+#endif
+
+struct lorawan_fuota_settings {
+    void (*progress)(uint16_t received, uint16_t total, uint16_t lost, void* context);
+    void (*complete)(int status, uint32_t size, void* context);
+    void* context;
+};
+
+int lorawan_fuota_init(const struct lorawan_fuota_settings* settings);
+
+const uint8_t* lorawan_fuota_image();
+
+int lorawan_fuota_erase();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+#ifndef _PICO_LORAWAN_QUEUE_H_
+#define _PICO_LORAWAN_QUEUE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// flash sectors below the NVM sectors used by the queue
+#ifndef LORAWAN_QUEUE_SECTORS
+#define LORAWAN_QUEUE_SECTORS 4
+#endif
+
+enum lorawan_queue_drop_policy {
+    // drop the oldest queued uplink to make room
+    LORAWAN_QUEUE_DROP_OLDEST = 0,
+    // refuse the new uplink
+    LORAWAN_QUEUE_DROP_NEWEST = 1,
+};
+
+enum lorawan_queue_order {
+    // oldest first
+    LORAWAN_QUEUE_FIFO = 0,
+    // highest priority first, then oldest first
+    LORAWAN_QUEUE_PRIORITY = 1,
+};
+
+struct lorawan_queue_settings {
+    // maximum queued uplinks, 0 for as many as the flash region holds
+    uint16_t capacity;
+    uint8_t drop_policy;
+    uint8_t order;
+};
+
+struct lorawan_queue_stats {
+    uint32_t appended;
+    uint32_t sent;
+    uint32_t dropped;
+    uint32_t flash_programs;
+    uint32_t flash_erases;
+};
+
+int lorawan_queue_init(const struct lorawan_queue_settings* settings);
+
+int lorawan_queue_append(const void* data, uint8_t data_len, uint8_t app_port, bool confirmed, uint8_t priority);
+
+int lorawan_queue_process();
+
+int lorawan_queue_count();
+
+int lorawan_queue_erase();
+
+int lorawan_queue_get_stats(struct lorawan_queue_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+#ifndef _PICO_LORAWAN_RELIABLE_H_
+#define _PICO_LORAWAN_RELIABLE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// uplinks are prefixed with a 16 bit epoch and a 16 bit sequence number
+#define LORAWAN_RELIABLE_HEADER_SIZE 4
+#define LORAWAN_RELIABLE_MAX_PAYLOAD (242 - LORAWAN_RELIABLE_HEADER_SIZE)
+
+#ifndef LORAWAN_RELIABLE_WINDOW
+#define LORAWAN_RELIABLE_WINDOW 8
+#endif
+
+struct lorawan_reliable_settings {
+    uint8_t app_port;
+
+    // downlink port the ACK bitmaps are received on
+    uint8_t ack_port;
+
+    // resend an uplink that has not been acknowledged within this time
+    uint32_t ack_timeout_ms;
+
+    // give up on an uplink after this many resends
+    uint8_t max_retries;
+};
+
+struct lorawan_reliable_stats {
+    uint32_t sent;
+    uint32_t retransmissions;
+    uint32_t acknowledged;
+    uint32_t dropped;
+    uint32_t acks_received;
+};
+
+int lorawan_reliable_init(const struct lorawan_reliable_settings* settings);
+
+int lorawan_reliable_send(const void* data, uint8_t data_len);
+
+int lorawan_reliable_process();
+
+int lorawan_reliable_receive(const uint8_t* data, int data_len, uint8_t app_port);
+
+int lorawan_reliable_pending();
+
+int lorawan_reliable_get_stats(struct lorawan_reliable_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
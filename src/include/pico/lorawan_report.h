@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+#ifndef _PICO_LORAWAN_REPORT_H_
+#define _PICO_LORAWAN_REPORT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LORAWAN_REPORT_MAX_CHANNELS 8
+
+// a setting of 0 disables that check
+struct lorawan_report_channel_settings {
+    // change since the last reported value
+    float deadband;
+
+    // change per second since the previous sample
+    float rate_threshold;
+
+    // extra change needed to report a move back in the opposite direction
+    float hysteresis;
+
+    // report at least this often as a heartbeat
+    uint32_t max_silence_ms;
+};
+
+struct lorawan_report_channel {
+    float sample;
+    uint32_t sample_time_ms;
+    float reported;
+    uint32_t reported_time_ms;
+    int8_t direction;
+    bool sampled;
+    bool has_reported;
+    bool due;
+};
+
+struct lorawan_report {
+    const struct lorawan_report_channel_settings* settings;
+    uint8_t channel_count;
+    struct lorawan_report_channel channels[LORAWAN_REPORT_MAX_CHANNELS];
+
+    uint32_t samples;
+    uint32_t reports;
+};
+
+int lorawan_report_init(struct lorawan_report* report, const struct lorawan_report_channel_settings* settings, uint8_t channel_count);
+
+int lorawan_report_sample(struct lorawan_report* report, uint8_t channel, float value);
+
+bool lorawan_report_due(struct lorawan_report* report);
+
+void lorawan_report_sent(struct lorawan_report* report);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
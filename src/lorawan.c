@@ -27,6 +27,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "hardware/flash.h"
+
 #include "pico/lorawan.h"
 
 #if USE_FREERTOS
@@ -40,14 +42,21 @@
 #endif
 
 #include "board.h"
+#include "eeprom-board.h"
 #include "rtc-board.h"
 #include "sx1276-board.h"
+#include "sx1276-board-events.h"
+#include "timer.h"
+#include "utilities.h"
 
 #include "../../periodic-uplink-lpp/firmwareVersion.h"
 #include "Commissioning.h"
 #include "RegionCommon.h"
 #include "LmHandler.h"
+#include "LmhpClockSync.h"
 #include "LmhpCompliance.h"
+#include "LmhpFragmentation.h"
+#include "LmhpRemoteMcastSetup.h"
 #include "LmHandlerMsgDisplay.h"
 #include "NvmDataMgmt.h"
 #include "LoRaMac.h"
@@ -93,6 +102,65 @@
  */
 #define LORAWAN_PUBLIC_NETWORK                      true
 
+/*!
+ * Number of US915 sub-bands, each with eight 125 kHz channels and one 500 kHz
+ * channel
+ */
+#define LORAWAN_US915_SUB_BANDS                     8
+
+/*!
+ * EEPROM address of the records kept by this library, the last page of the
+ * EEPROM is reserved for them after the LoRaMac NVM contexts
+ */
+#define LORAWAN_NVM_RECORDS_ADDR                    ( FLASH_SECTOR_SIZE - FLASH_PAGE_SIZE )
+
+/*!
+ * EEPROM address of the join strategy record
+ */
+#define LORAWAN_JOIN_NVM_ADDR                       ( LORAWAN_NVM_RECORDS_ADDR )
+
+/*!
+ * Join strategy record magic number ("JOIN")
+ */
+#define LORAWAN_JOIN_NVM_MAGIC                      0x4a4f494e
+
+/*!
+ * Sub-band and data rate of the last successful join
+ */
+typedef struct JoinNvm_s
+{
+    uint32_t Magic;
+    uint8_t SubBand;
+    int8_t Datarate;
+    uint16_t Reserved;
+    uint32_t Crc32;
+} JoinNvm_t;
+
+/*!
+ * EEPROM address of the frame counter persistence record
+ */
+#define LORAWAN_FCNT_NVM_ADDR                       ( LORAWAN_JOIN_NVM_ADDR + sizeof( JoinNvm_t ) )
+
+/*!
+ * Frame counter persistence record magic number ("FCNT")
+ */
+#define LORAWAN_FCNT_NVM_MAGIC                      0x46434e54
+
+/*!
+ * Frame counter persistence interval and uplink frame counter the stored
+ * contexts were flushed with
+ */
+typedef struct FCntNvm_s
+{
+    uint32_t Magic;
+    uint16_t Interval;
+    uint16_t Reserved;
+    uint32_t FCntUp;
+    uint32_t Crc32;
+} FCntNvm_t;
+
+_Static_assert( sizeof( LoRaMacNvmData_t ) <= LORAWAN_NVM_RECORDS_ADDR, "LoRaMac NVM contexts overlap the library records" );
+
 /*!
  * User application data
  */
@@ -115,6 +183,7 @@ static LmHandlerAppData_t AppData =
 static SemaphoreHandle_t xLoRaWANMutex = NULL;
 static SemaphoreHandle_t xTxDoneSemaphore = NULL;
 static SemaphoreHandle_t xRxDoneSemaphore = NULL;
+static SemaphoreHandle_t xJoinDoneSemaphore = NULL;
 static TaskHandle_t xLoRaWANTaskHandle = NULL;
 
 /*!
@@ -149,6 +218,18 @@ static void OnTxPeriodicityChanged( uint32_t periodicity );
 static void OnTxFrameCtrlChanged( LmHandlerMsgTypes_t isTxConfirmed );
 static void OnPingSlotPeriodicityChanged( uint8_t pingSlotPeriodicity );
 
+static void OnJoinBackoffTimerEvent( void* context );
+static void OnRadioEvent( uint8_t event, uint32_t timestamp );
+static void ChannelQualityUpdate( LmHandlerTxParams_t* params );
+static bool ChannelMaskGet( uint16_t* mask, uint16_t size );
+static void ChannelMaskSet( uint16_t* mask );
+static bool ChannelMaskIsSet( const uint16_t* mask, uint8_t channel );
+static void TimelineBegin( void );
+static void JoinStart( void );
+static void NvmFlush( void );
+static void ProcessPendingEvents( void );
+static void RequestClass( bool retry );
+
 static LmHandlerCallbacks_t LmHandlerCallbacks =
 {
     .GetBatteryLevel = BoardGetBatteryLevel,
@@ -203,20 +284,304 @@ static const struct lorawan_abp_settings* AbpSettings = NULL;
 
 static const struct lorawan_otaa_settings* OtaaSettings = NULL;
 
-static uint8_t AppRxDataBuffer[LORAWAN_APP_DATA_BUFFER_MAX_SIZE];
+/*!
+ * Received downlinks are queued for lorawan_receive, so a burst (e.g. in
+ * class C) is not lost while the application is busy. Must be a power of 2.
+ */
+#ifndef LORAWAN_DOWNLINK_QUEUE_SIZE
+#define LORAWAN_DOWNLINK_QUEUE_SIZE                 4
+#endif
+
+_Static_assert((LORAWAN_DOWNLINK_QUEUE_SIZE & (LORAWAN_DOWNLINK_QUEUE_SIZE - 1)) == 0,
+               "LORAWAN_DOWNLINK_QUEUE_SIZE must be a power of 2");
 
-static LmHandlerAppData_t AppRxData =
+typedef struct
 {
-    .Buffer = AppRxDataBuffer,
-    .BufferSize = 0,
-    .Port = 0,
-};
+    uint8_t Port;
+    uint8_t BufferSize;
+    // time the radio received the frame, for the delivery latency
+    uint32_t RxEndUs;
+    uint8_t Buffer[LORAWAN_APP_DATA_BUFFER_MAX_SIZE];
+}Downlink_t;
+
+static Downlink_t DownlinkQueue[LORAWAN_DOWNLINK_QUEUE_SIZE];
+static volatile uint32_t DownlinkHead = 0;
+static volatile uint32_t DownlinkTail = 0;
+
+static uint32_t DownlinkRxEndUs = 0;
+
+/*!
+ * Class requested by the application, switched to once joined
+ */
+static DeviceClass_t RequestedClass = LORAWAN_DEFAULT_CLASS;
+
+/*!
+ * The class request after the join was refused (e.g. the MAC was still
+ * busy), it is retried once the MAC is idle
+ */
+static volatile bool ClassRequestPending = false;
 
 static bool Debug = false;
 
+/*!
+ * Debug output is recorded from the MAC callbacks into a ring of fixed size
+ * records and printed from ProcessPendingEvents while the MAC is idle
+ */
+#ifndef LORAWAN_DEBUG_LOG_RECORDS
+#define LORAWAN_DEBUG_LOG_RECORDS 16
+#endif
+
+/*!
+ * Bytes of TX and RX payload kept per record
+ */
+#ifndef LORAWAN_DEBUG_LOG_DATA_SIZE
+#define LORAWAN_DEBUG_LOG_DATA_SIZE 64
+#endif
+
+typedef enum eDebugLogType
+{
+    DEBUG_LOG_NVM_DATA_CHANGE,
+    DEBUG_LOG_NVM_WARM_RESTORE,
+    DEBUG_LOG_NETWORK_PARAMETERS,
+    DEBUG_LOG_MCPS_REQUEST,
+    DEBUG_LOG_MLME_REQUEST,
+    DEBUG_LOG_JOIN_ATTEMPT,
+    DEBUG_LOG_JOIN_REQUEST,
+    DEBUG_LOG_TX_DATA,
+    DEBUG_LOG_RX_DATA,
+    DEBUG_LOG_CLASS_CHANGE,
+    DEBUG_LOG_CLASS_REQUEST_FAILED,
+    DEBUG_LOG_BEACON_STATUS,
+}DebugLogType_t;
+
+typedef struct sDebugLogRecord
+{
+    DebugLogType_t Type;
+    union
+    {
+        struct
+        {
+            LmHandlerNvmContextStates_t State;
+            uint16_t Size;
+        }NvmDataChange;
+        CommissioningParams_t* NetworkParameters;
+        struct
+        {
+            LoRaMacStatus_t Status;
+            McpsReq_t Request;
+            TimerTime_t NextTxIn;
+        }McpsRequest;
+        struct
+        {
+            LoRaMacStatus_t Status;
+            MlmeReq_t Request;
+            TimerTime_t NextTxIn;
+        }MlmeRequest;
+        struct
+        {
+            uint32_t Attempt;
+            uint8_t SubBand;
+            int8_t Datarate;
+        }JoinAttempt;
+        LmHandlerJoinParams_t JoinRequest;
+        LmHandlerTxParams_t TxData;
+        struct
+        {
+            LmHandlerAppData_t AppData;
+            LmHandlerRxParams_t Params;
+        }RxData;
+        DeviceClass_t ClassChange;
+        DeviceClass_t ClassRequestFailed;
+        LoRaMacHandlerBeaconParams_t BeaconStatus;
+    }Params;
+    uint8_t Data[LORAWAN_DEBUG_LOG_DATA_SIZE];
+}DebugLogRecord_t;
+
+static DebugLogRecord_t DebugLog[LORAWAN_DEBUG_LOG_RECORDS];
+static uint32_t DebugLogHead = 0;
+static uint32_t DebugLogTail = 0;
+static uint32_t DebugLogDropped = 0;
+
+static DebugLogRecord_t* DebugLogAlloc( DebugLogType_t type );
+static void DebugLogCommit( void );
+
+static const struct lorawan_join_settings* JoinSettings = NULL;
+
+static JoinNvm_t JoinNvm;
+
+/*!
+ * Number of join requests sent since the join was started
+ */
+static uint32_t JoinAttempts = 0;
+
+static uint8_t JoinSubBand = 0;
+
+static int8_t JoinDatarate = LORAWAN_DEFAULT_DATARATE;
+
+/*!
+ * LmHandlerJoin takes the join data rate from LmHandlerParams, the configured
+ * data rate is kept here while a join is in progress and restored after
+ */
+static int8_t JoinSavedTxDatarate;
+static bool JoinTxDatarateSaved = false;
+
+/*!
+ * An OTAA join request resets the channel mask to the default channel mask,
+ * so each attempt sets both. The default mask configured by the application
+ * is kept here while a join request is in progress and restored after
+ */
+static uint16_t JoinSavedDefaultMask[6];
+static bool JoinDefaultMaskSaved = false;
+
+static TimerEvent_t JoinBackoffTimer;
+
+static volatile bool JoinRetryPending = false;
+
+/*!
+ * Number of uplinks between flash writes of the frame counters, 1 writes
+ * every change
+ */
+static uint16_t FCntPersistInterval = 1;
+
+/*!
+ * Frame counter persistence interval of the contexts in flash, 0 if unknown
+ */
+static uint16_t FCntPersistedInterval = 0;
+
+/*!
+ * Uplink frame counter in flash
+ */
+static uint32_t FCntUpPersisted = 0;
+
+/*!
+ * CRCs of the NVM groups in flash that are not amortized
+ */
+static uint32_t NvmGroupCrcPersisted[4];
+
+/*!
+ * Crypto context in flash, without the uplink frame counter and CRC
+ */
+static LoRaMacCryptoNvmData_t NvmCryptoPersisted;
+
+/*!
+ * Set when a library record is written to the EEPROM cache
+ */
+static bool NvmRecordsChanged = false;
+
+static struct lorawan_nvm_stats NvmStats;
+
+/*!
+ * MAC statistics, counted at the callback boundary. The averages are
+ * computed from the sums when a snapshot is taken.
+ */
+static struct lorawan_stats Stats;
+static int32_t StatsRssiSum = 0;
+static int32_t StatsSnrSum = 0;
+
+/*!
+ * Time the duty cycle allows the next uplink, as returned by the last
+ * MAC request
+ */
+static absolute_time_t NextTxTime;
+
+/*!
+ * LoRaWAN frame overhead of an uplink without MAC commands: MHDR, DevAddr,
+ * FCtrl, FCnt, FPort and MIC
+ */
+#define LORAWAN_FRAME_OVERHEAD 13
+
+/*!
+ * US915 spreading factor and bandwidth (0: 125 kHz, 2: 500 kHz) of the
+ * data rates, 0 for RFU data rates
+ */
+static const uint8_t DatarateSpreadingFactors[] = { 10, 9, 8, 7, 8, 0, 0, 0, 12, 11, 10, 9, 8, 7 };
+static const uint8_t DatarateBandwidths[] = { 0, 0, 0, 0, 2, 0, 0, 0, 2, 2, 2, 2, 2, 2 };
+
+/*!
+ * Link quality of an uplink channel
+ */
+typedef struct ChannelQuality_s
+{
+    uint32_t Uplinks;
+    uint32_t Acks;
+    // confirmed uplinks and ACKs since the channel was last judged
+    uint16_t WindowUplinks;
+    uint16_t WindowAcks;
+    int16_t Rssi;
+    int8_t Snr;
+    bool HasRx;
+}ChannelQuality_t;
+
+/*!
+ * 125 kHz channels the adaptive channel mask always keeps enabled
+ */
+#define LORAWAN_ADAPTIVE_MIN_CHANNELS 2
+
+/*!
+ * US915 channel mask size in 16 bit words
+ */
+#define LORAWAN_CHANNELS_MASK_SIZE 6
+
+static ChannelQuality_t ChannelQuality[LORAWAN_CHANNELS];
+
+/*!
+ * Channel of the last completed uplink, downlinks are attributed to it
+ */
+static uint8_t ChannelLast = 0;
+
+static const struct lorawan_adaptive_channels_settings* AdaptiveChannelsSettings = NULL;
+
+/*!
+ * Channel mask set by the application or network before adaptive masking,
+ * and the one last applied
+ */
+static uint16_t AdaptiveChannelsBaseMask[LORAWAN_CHANNELS_MASK_SIZE];
+static uint16_t AdaptiveChannelsMask[LORAWAN_CHANNELS_MASK_SIZE];
+static uint16_t AdaptiveChannelsExcluded[LORAWAN_CHANNELS_MASK_SIZE];
+static uint32_t AdaptiveChannelsUplinks = 0;
+
+/*!
+ * Transmissions of the current uplink, and the start of the last one
+ */
+static volatile uint8_t StatsTxCount = 0;
+static uint32_t StatsTxStartUs = 0;
+
+/*!
+ * Timeline of the last uplink, radio events are also recorded from
+ * interrupts
+ */
+static volatile struct lorawan_timeline Timeline;
+
+/*!
+ * RX window the radio is receiving in after TX done, 1 or 2
+ */
+static volatile uint8_t TimelineRxWindow = 0;
+
+/*!
+ * Set on MCPS confirm, the timeline is displayed from ProcessPendingEvents
+ */
+static bool TimelineDisplayPending = false;
+
 extern void EepromMcuInit();
+extern bool EepromMcuIsWarmStart();
+extern void EepromMcuRetain();
 extern uint8_t EepromMcuFlush();
 
+extern bool BoardSetClockScaling( uint32_t lowKhz, uint32_t highKhz );
+extern void BoardClockBoostBegin( void );
+extern void BoardClockBoostEnd( void );
+
+/*!
+ * Set while the clock is boosted for a frame that may have been received
+ */
+static bool ClockBoostRx = false;
+
+extern void SX1276SetIrqNotify( void ( *notify )( void ) );
+extern void SX1276SetLbt( uint8_t cadCount, uint32_t backoffMinMs, uint32_t backoffMaxMs, uint32_t maxDelayMs );
+#if LORAWAN_RADIO_TRACE
+extern int SX1276TraceRead( uint8_t *buffer, uint32_t size );
+#endif
+
 const char* lorawan_default_dev_eui(char* dev_eui)
 {
     uint8_t boardId[8];
@@ -239,8 +604,9 @@ int lorawan_init(const struct lorawan_sx1276_settings* sx1276_settings, LoRaMacR
     xLoRaWANMutex = xSemaphoreCreateMutex();
     xTxDoneSemaphore = xSemaphoreCreateBinary();
     xRxDoneSemaphore = xSemaphoreCreateBinary();
+    xJoinDoneSemaphore = xSemaphoreCreateBinary();
     
-    if (xLoRaWANMutex == NULL || xTxDoneSemaphore == NULL || xRxDoneSemaphore == NULL) {
+    if (xLoRaWANMutex == NULL || xTxDoneSemaphore == NULL || xRxDoneSemaphore == NULL || xJoinDoneSemaphore == NULL) {
         return -1;
     }
     
@@ -250,6 +616,22 @@ int lorawan_init(const struct lorawan_sx1276_settings* sx1276_settings, LoRaMacR
 
     EepromMcuInit();
 
+    EepromMcuReadBuffer(LORAWAN_JOIN_NVM_ADDR, (uint8_t*)&JoinNvm, sizeof(JoinNvm));
+
+    FCntNvm_t fcntNvm;
+    EepromMcuReadBuffer(LORAWAN_FCNT_NVM_ADDR, (uint8_t*)&fcntNvm, sizeof(fcntNvm));
+
+    if ((fcntNvm.Magic == LORAWAN_FCNT_NVM_MAGIC) &&
+        (fcntNvm.Crc32 == Crc32((uint8_t*)&fcntNvm, sizeof(fcntNvm) - sizeof(fcntNvm.Crc32)))) {
+        FCntPersistedInterval = fcntNvm.Interval;
+        FCntUpPersisted = fcntNvm.FCntUp;
+    } else {
+        FCntPersistedInterval = 0;
+        FCntUpPersisted = 0;
+    }
+
+    TimerInit(&JoinBackoffTimer, OnJoinBackoffTimerEvent);
+
     RtcInit();
     SpiInit(
         &SX1276.Spi,
@@ -264,9 +646,17 @@ int lorawan_init(const struct lorawan_sx1276_settings* sx1276_settings, LoRaMacR
     SX1276.Reset.pin = sx1276_settings->reset;
     SX1276.DIO0.pin = sx1276_settings->dio0;
     SX1276.DIO1.pin = sx1276_settings->dio1;
+    SX1276.DIO2.pin = (sx1276_settings->dio_mask & (1 << 2)) ? sx1276_settings->dio2 : NC;
+    SX1276.DIO3.pin = (sx1276_settings->dio_mask & (1 << 3)) ? sx1276_settings->dio3 : NC;
+    SX1276.DIO4.pin = (sx1276_settings->dio_mask & (1 << 4)) ? sx1276_settings->dio4 : NC;
+    SX1276.DIO5.pin = (sx1276_settings->dio_mask & (1 << 5)) ? sx1276_settings->dio5 : NC;
 
     SX1276IoInit();
 
+    // DIO events are handled in LmHandlerProcess, wake it up on each edge
+    SX1276SetIrqNotify(OnMacProcessNotify);
+    SX1276SetEventCallback(OnRadioEvent);
+
     // check version register
     if (SX1276Read(REG_LR_VERSION) != 0x12) {
         return -1;
@@ -313,25 +703,146 @@ int lorawan_init_otaa(const struct lorawan_sx1276_settings* sx1276_settings, LoR
     return lorawan_init(sx1276_settings, region);
 }
 
+int lorawan_set_join_settings(const struct lorawan_join_settings* join_settings)
+{
+    if (join_settings != NULL) {
+        if (join_settings->sub_bands != NULL) {
+            if (join_settings->num_sub_bands == 0) {
+                return -1;
+            }
+
+            for (int i = 0; i < join_settings->num_sub_bands; i++) {
+                if (join_settings->sub_bands[i] < 1 || join_settings->sub_bands[i] > LORAWAN_US915_SUB_BANDS) {
+                    return -1;
+                }
+            }
+        }
+
+        if (join_settings->datarates != NULL && join_settings->num_datarates == 0) {
+            return -1;
+        }
+
+        if (join_settings->backoff_max_ms < join_settings->backoff_min_ms) {
+            return -1;
+        }
+    }
+
+    JoinSettings = join_settings;
+
+    return 0;
+}
+
 int lorawan_join()
 {
-    LmHandlerJoin( );
+    JoinStart( );
+
+    return 0;
+}
+
+#if USE_FREERTOS
+int lorawan_join_wait(uint32_t timeout_ms)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+    TickType_t elapsed;
+
+    if (xSemaphoreTake(xLoRaWANMutex, timeout) != pdTRUE) {
+        return -1;
+    }
+
+    if (lorawan_is_joined()) {
+        xSemaphoreGive(xLoRaWANMutex);
+        return 0;
+    }
+
+    // Clear any stale join notification
+    (void)xSemaphoreTake(xJoinDoneSemaphore, 0);
+
+    JoinStart();
+
+    xSemaphoreGive(xLoRaWANMutex);
+
+    // The LoRaWAN task processes the join attempts and their retries, within
+    // what is left of the timeout after waiting for the mutex
+    elapsed = xTaskGetTickCount() - start;
+
+    if (elapsed >= timeout || xSemaphoreTake(xJoinDoneSemaphore, timeout - elapsed) != pdTRUE) {
+        return -1;
+    }
 
     return 0;
 }
+#else
+int lorawan_join_wait(uint32_t timeout_ms)
+{
+    absolute_time_t timeout_time = make_timeout_time_ms(timeout_ms);
+
+    if (lorawan_is_joined()) {
+        return 0;
+    }
+
+    JoinStart();
+
+    do {
+        lorawan_process();
+
+        if (lorawan_is_joined()) {
+            return 0;
+        }
+    } while (!best_effort_wfe_or_timeout(timeout_time));
+
+    return -1; // timed out
+}
+#endif
 
 int lorawan_is_joined()
 {
     return (LmHandlerJoinStatus() == LORAMAC_HANDLER_SET);
 }
 
+/*!
+ * Uplinks and join requests are built and encrypted before LmHandlerSend and
+ * LmHandlerJoin return, at the high clock when clock scaling is enabled
+ */
+static LmHandlerErrorStatus_t SendRequest( LmHandlerAppData_t* appData, LmHandlerMsgTypes_t isTxConfirmed )
+{
+    BoardClockBoostBegin( );
+    LmHandlerErrorStatus_t status = LmHandlerSend( appData, isTxConfirmed );
+    BoardClockBoostEnd( );
+
+    return status;
+}
+
+static void JoinRequest( void )
+{
+    BoardClockBoostBegin( );
+    LmHandlerJoin( );
+    BoardClockBoostEnd( );
+}
+
+/*!
+ * A received frame is parsed and decrypted by the LmHandlerProcess call that
+ * handles the end of the RX window, the clock is boosted from that radio
+ * event until the call returns
+ */
+static void ClockBoostRxEnd( void )
+{
+    if (ClockBoostRx) {
+        ClockBoostRx = false;
+        BoardClockBoostEnd( );
+    }
+}
+
 int lorawan_process()
 {
     int sleep = 0;
 
-    // Processes the LoRaMac events
     LmHandlerProcess( );
 
+    ClockBoostRxEnd( );
+
+    ProcessPendingEvents( );
+
     CRITICAL_SECTION_BEGIN( );
     if( IsMacProcessPending == 1 )
     {
@@ -357,7 +868,7 @@ int lorawan_process_timeout_ms(uint32_t timeout_ms)
     do {
         lorawan_process();
 
-        if (AppRxData.Port) {
+        if (DownlinkHead != DownlinkTail) {
             return 0;
         } else if (joined != lorawan_is_joined()) {
             return 0;
@@ -371,14 +882,20 @@ int lorawan_send_unconfirmed(const void* data, uint8_t data_len, uint8_t app_por
 {
     LmHandlerAppData_t appData;
 
+    TimelineBegin( );
+
     appData.Port = app_port;
     appData.BufferSize = data_len;
     appData.Buffer = (uint8_t*)data;
 
-    if (LmHandlerSend(&appData, LORAMAC_HANDLER_UNCONFIRMED_MSG) != LORAMAC_HANDLER_SUCCESS) {
+    LmHandlerErrorStatus_t status = SendRequest(&appData, LORAMAC_HANDLER_UNCONFIRMED_MSG);
+
+    if (status != LORAMAC_HANDLER_SUCCESS) {
         return -1;
     }
 
+    Timeline.send_accept_us = time_us_32( );
+
     return 0;
 }
 
@@ -386,14 +903,20 @@ int lorawan_send_confirmed(const void* data, uint8_t data_len, uint8_t app_port)
 {
     LmHandlerAppData_t appData;
 
+    TimelineBegin( );
+
     appData.Port = app_port;
     appData.BufferSize = data_len;
     appData.Buffer = (uint8_t*)data;
 
-    if (LmHandlerSend(&appData, LORAMAC_HANDLER_CONFIRMED_MSG) != LORAMAC_HANDLER_SUCCESS) {
+    LmHandlerErrorStatus_t status = SendRequest(&appData, LORAMAC_HANDLER_CONFIRMED_MSG);
+
+    if (status != LORAMAC_HANDLER_SUCCESS) {
         return -1;
     }
 
+    Timeline.send_accept_us = time_us_32( );
+
     return 0;
 }
 
@@ -409,6 +932,8 @@ int lorawan_send_confirmed_wait(const void* data, uint8_t data_len, uint8_t app_
 {
     LmHandlerAppData_t appData;
 
+    TimelineBegin( );
+
     appData.Port = app_port;
     appData.BufferSize = data_len;
     appData.Buffer = (uint8_t*)data;
@@ -416,10 +941,14 @@ int lorawan_send_confirmed_wait(const void* data, uint8_t data_len, uint8_t app_
     // Reset confirmation status
     LastConfirmedMessageAcked = false;
 
-    if (LmHandlerSend(&appData, LORAMAC_HANDLER_CONFIRMED_MSG) != LORAMAC_HANDLER_SUCCESS) {
+    LmHandlerErrorStatus_t status = SendRequest(&appData, LORAMAC_HANDLER_CONFIRMED_MSG);
+
+    if (status != LORAMAC_HANDLER_SUCCESS) {
         return -1;
     }
 
+    Timeline.send_accept_us = time_us_32( );
+
     // Wait for confirmation with timeout
     absolute_time_t timeout_time = make_timeout_time_ms(timeout_ms);
     do {
@@ -433,23 +962,64 @@ int lorawan_send_confirmed_wait(const void* data, uint8_t data_len, uint8_t app_
 
 int lorawan_receive(void* data, uint8_t data_len, uint8_t* app_port)
 {
-    *app_port = AppRxData.Port;
-    if (*app_port == 0) {
+    if (DownlinkHead == DownlinkTail) {
+        *app_port = 0;
         return -1;
     }
 
-    int receive_length = AppRxData.BufferSize;
+    Downlink_t* downlink = &DownlinkQueue[DownlinkTail % LORAWAN_DOWNLINK_QUEUE_SIZE];
+
+    *app_port = downlink->Port;
+
+    int receive_length = downlink->BufferSize;
 
     if (data_len < receive_length) {
         receive_length = data_len;
     }
 
-    memcpy(data, AppRxData.Buffer, receive_length);
-    AppRxData.Port = 0;
+    memcpy(data, downlink->Buffer, receive_length);
+
+    uint32_t latency_us = time_us_32( ) - downlink->RxEndUs;
+
+    CRITICAL_SECTION_BEGIN( );
+    Stats.downlink_latency_us_last = latency_us;
+    if (latency_us > Stats.downlink_latency_us_max) {
+        Stats.downlink_latency_us_max = latency_us;
+    }
+    DownlinkTail++;
+    CRITICAL_SECTION_END( );
 
     return receive_length;
 }
 
+int lorawan_request_class(enum lorawan_class device_class)
+{
+    if (device_class > LORAWAN_CLASS_C) {
+        return -1;
+    }
+
+#if !defined( LORAMAC_CLASSB_ENABLED )
+    // the MAC silently stays in class A
+    if (device_class == LORAWAN_CLASS_B) {
+        return -1;
+    }
+#endif
+
+    RequestedClass = (DeviceClass_t)device_class;
+
+    // before the join, the class is requested once joined
+    if (lorawan_is_joined() && LmHandlerRequestClass( RequestedClass ) != LORAMAC_HANDLER_SUCCESS) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int lorawan_get_class()
+{
+    return LmHandlerGetCurrentClass( );
+}
+
 void lorawan_debug(bool debug)
 {
     Debug = debug;
@@ -474,13 +1044,210 @@ int lorawan_set_confirmed_retry_count(uint8_t retry_count)
     return 0;
 }
 
-int lorawan_erase_nvm()
+int lorawan_set_clock_scaling(uint32_t low_khz, uint32_t high_khz)
+{
+    if (low_khz != 0 && high_khz < low_khz) {
+        return -1;
+    }
+
+    if (!BoardSetClockScaling(low_khz, high_khz)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int lorawan_set_lbt(const struct lorawan_lbt_settings* lbt_settings)
+{
+    if (lbt_settings == NULL) {
+        SX1276SetLbt(0, 0, 0, 0);
+
+        return 0;
+    }
+
+    if (lbt_settings->backoff_max_ms < lbt_settings->backoff_min_ms) {
+        return -1;
+    }
+
+    SX1276SetLbt(
+        lbt_settings->cad_count,
+        lbt_settings->backoff_min_ms,
+        lbt_settings->backoff_max_ms,
+        lbt_settings->max_delay_ms
+    );
+
+    return 0;
+}
+
+int lorawan_trace_read(void* buffer, size_t size)
+{
+#if LORAWAN_RADIO_TRACE
+    if (buffer == NULL) {
+        return -1;
+    }
+
+    return SX1276TraceRead(buffer, size);
+#else
+    return -1;
+#endif
+}
+
+int lorawan_get_last_timeline(struct lorawan_timeline* timeline)
+{
+    if (timeline == NULL) {
+        return -1;
+    }
+
+    CRITICAL_SECTION_BEGIN( );
+    memcpy(timeline, (const void*)&Timeline, sizeof(*timeline));
+    CRITICAL_SECTION_END( );
+
+    return 0;
+}
+
+int lorawan_get_stats(struct lorawan_stats* stats)
+{
+    if (stats == NULL) {
+        return -1;
+    }
+
+    CRITICAL_SECTION_BEGIN( );
+    *stats = Stats;
+    CRITICAL_SECTION_END( );
+
+    if (stats->downlinks > 0) {
+        stats->rssi_avg = StatsRssiSum / (int32_t)stats->downlinks;
+        stats->snr_avg = StatsSnrSum / (int32_t)stats->downlinks;
+    }
+
+    return 0;
+}
+
+int32_t lorawan_next_tx_in_ms()
+{
+    int64_t next_tx_in_us = absolute_time_diff_us(get_absolute_time(), NextTxTime);
+
+    if (LmHandlerIsBusy()) {
+        // An uplink is in progress, it ends with the RX2 window
+        MibRequestConfirm_t mibReq;
+        uint32_t tx_done_us = Timeline.tx_done_us;
+        int64_t busy_us;
+
+        mibReq.Type = MIB_RECEIVE_DELAY_2;
+        if (LoRaMacMibGetRequestConfirm(&mibReq) != LORAMAC_STATUS_OK) {
+            return 1;
+        }
+
+        busy_us = (int64_t)mibReq.Param.ReceiveDelay2 * 1000;
+        if (tx_done_us != 0) {
+            busy_us -= (int32_t)(time_us_32() - tx_done_us);
+        }
+
+        next_tx_in_us = MAX(next_tx_in_us, MAX(busy_us, 1000));
+    }
+
+    if (next_tx_in_us <= 0) {
+        return 0;
+    }
+
+    return (next_tx_in_us + 999) / 1000;
+}
+
+int32_t lorawan_time_on_air(uint8_t len, int8_t dr)
+{
+    if (dr < 0 || dr >= (int8_t)sizeof(DatarateSpreadingFactors) || DatarateSpreadingFactors[dr] == 0) {
+        return -1;
+    }
+
+    // Same modulation parameters as the US915 region TX configuration
+    return Radio.TimeOnAir(MODEM_LORA, DatarateBandwidths[dr], DatarateSpreadingFactors[dr], 1, 8, false,
+                           MIN(len + LORAWAN_FRAME_OVERHEAD, 255), true);
+}
+
+int lorawan_max_payload_now()
+{
+    LoRaMacTxInfo_t txInfo;
+
+    // Accounts for the current data rate and pending MAC commands
+    if (LoRaMacQueryTxPossible(0, &txInfo) != LORAMAC_STATUS_OK) {
+        return -1;
+    }
+
+    return txInfo.MaxPossibleApplicationDataSize;
+}
+
+int lorawan_get_channel_stats(uint8_t channel, struct lorawan_channel_stats* channel_stats)
+{
+    if (channel >= LORAWAN_CHANNELS || channel_stats == NULL) {
+        return -1;
+    }
+
+    channel_stats->uplinks = ChannelQuality[channel].Uplinks;
+    channel_stats->acks = ChannelQuality[channel].Acks;
+    channel_stats->rssi = ChannelQuality[channel].Rssi;
+    channel_stats->snr = ChannelQuality[channel].Snr;
+    channel_stats->excluded = ChannelMaskIsSet(AdaptiveChannelsExcluded, channel);
+
+    return 0;
+}
+
+int lorawan_set_adaptive_channels(const struct lorawan_adaptive_channels_settings* settings)
+{
+    if (settings != NULL && settings->min_ack_percent > 100) {
+        return -1;
+    }
+
+    // Give the excluded channels back when disabling
+    if (settings == NULL && AdaptiveChannelsSettings != NULL) {
+        uint16_t mask[LORAWAN_CHANNELS_MASK_SIZE];
+
+        if (ChannelMaskGet(mask, sizeof(mask)) && memcmp(mask, AdaptiveChannelsMask, sizeof(mask)) == 0) {
+            ChannelMaskSet(AdaptiveChannelsBaseMask);
+        }
+    }
+
+    memset(AdaptiveChannelsExcluded, 0, sizeof(AdaptiveChannelsExcluded));
+    memset(AdaptiveChannelsMask, 0, sizeof(AdaptiveChannelsMask));
+    AdaptiveChannelsUplinks = 0;
+
+    AdaptiveChannelsSettings = settings;
+
+    return 0;
+}
+
+int lorawan_set_fcnt_persist_interval(uint16_t interval)
+{
+    if (interval == 0) {
+        return -1;
+    }
+
+    FCntPersistInterval = interval;
+
+    return 0;
+}
+
+int lorawan_get_nvm_stats(struct lorawan_nvm_stats* nvm_stats)
+{
+    if (nvm_stats == NULL) {
+        return -1;
+    }
+
+    *nvm_stats = NvmStats;
+
+    return 0;
+}
+
+int lorawan_erase_nvm()
 {
     if (!NvmDataMgmtFactoryReset()) {
         return -1;
     }
 
-    EepromMcuFlush();
+    // Forget the join strategy too
+    memset(&JoinNvm, 0, sizeof(JoinNvm));
+    EepromMcuWriteBuffer(LORAWAN_JOIN_NVM_ADDR, (uint8_t*)&JoinNvm, sizeof(JoinNvm));
+
+    NvmFlush();
 
     return 0;
 }
@@ -513,6 +1280,20 @@ int lorawan_get_adr_enabled(int* adr_enabled)
     return 0;
 }
 
+int lorawan_get_datarate(int8_t* datarate)
+{
+    if (datarate == NULL) {
+        return -1;
+    }
+    MibRequestConfirm_t mibReq;
+    mibReq.Type = MIB_CHANNELS_DATARATE;
+    if (LoRaMacMibGetRequestConfirm(&mibReq) != LORAMAC_STATUS_OK) {
+        return -1;
+    }
+    *datarate = mibReq.Param.ChannelsDatarate;
+    return 0;
+}
+
 int lorawan_last_ack_received(void)
 {
 #if USE_FREERTOS
@@ -535,13 +1316,157 @@ static void OnMacProcessNotify( void )
     IsMacProcessPending = 1;
 }
 
+static LoRaMacNvmData_t* NvmContexts( void )
+{
+    MibRequestConfirm_t mibReq;
+
+    mibReq.Type = MIB_NVM_CTXS;
+    LoRaMacMibGetRequestConfirm( &mibReq );
+
+    return mibReq.Param.Contexts;
+}
+
+static void NvmGroupCrcs( LoRaMacNvmData_t* nvm, uint32_t crcs[4] )
+{
+    crcs[0] = nvm->MacGroup2.Crc32;
+    crcs[1] = nvm->SecureElement.Crc32;
+    crcs[2] = nvm->RegionGroup2.Crc32;
+    crcs[3] = nvm->ClassB.Crc32;
+}
+
+/*!
+ * Crypto context without the uplink frame counter, so the downlink frame
+ * counters and the join nonces are not amortized
+ */
+static void NvmCryptoUnamortized( LoRaMacNvmData_t* nvm, LoRaMacCryptoNvmData_t* crypto )
+{
+    memcpy( crypto, &nvm->Crypto, sizeof( *crypto ) );
+    crypto->FCntList.FCntUp = 0;
+    crypto->Crc32 = 0;
+}
+
+static void NvmFlush( void )
+{
+    LoRaMacNvmData_t* nvm = NvmContexts( );
+    FCntNvm_t fcntNvm =
+    {
+        .Magic = LORAWAN_FCNT_NVM_MAGIC,
+        .Interval = FCntPersistInterval,
+        .Reserved = 0,
+        .FCntUp = nvm->Crypto.FCntList.FCntUp,
+    };
+
+    // Record what reaches flash, a warm start resumes from the retained
+    // cache but still needs to know how far flash lags behind
+    fcntNvm.Crc32 = Crc32( ( uint8_t* )&fcntNvm, sizeof( fcntNvm ) - sizeof( fcntNvm.Crc32 ) );
+    EepromMcuWriteBuffer( LORAWAN_FCNT_NVM_ADDR, ( uint8_t* )&fcntNvm, sizeof( fcntNvm ) );
+
+    // Only the first flush of an uplink is kept, it is the one that may
+    // overlap the RX windows
+    bool timelineFlush = ( Timeline.send_entry_us != 0 ) && ( Timeline.nvm_flush_start_us == 0 );
+
+    if (timelineFlush) {
+        Timeline.nvm_flush_start_us = time_us_32( );
+    }
+
+    EepromMcuFlush( );
+
+    if (timelineFlush) {
+        Timeline.nvm_flush_end_us = time_us_32( );
+    }
+
+    NvmStats.flash_writes++;
+    NvmRecordsChanged = false;
+    FCntPersistedInterval = fcntNvm.Interval;
+    FCntUpPersisted = fcntNvm.FCntUp;
+    NvmGroupCrcs( nvm, NvmGroupCrcPersisted );
+    NvmCryptoUnamortized( nvm, &NvmCryptoPersisted );
+}
+
+/*!
+ * Checks if the EEPROM cache must reach flash. With a frame counter
+ * persistence interval, updates of the per-uplink bookkeeping (uplink frame
+ * counter, MAC group 1 and region group 1) only reach flash every interval
+ * uplinks, any other context change is written immediately. That includes
+ * the downlink frame counters, so a replayed downlink is still rejected
+ * after a power loss.
+ */
+static bool NvmFlushRequired( void )
+{
+    LoRaMacNvmData_t* nvm = NvmContexts( );
+    uint32_t crcs[4];
+    LoRaMacCryptoNvmData_t crypto;
+
+    if (FCntPersistInterval <= 1 || FCntPersistedInterval != FCntPersistInterval || NvmRecordsChanged) {
+        return true;
+    }
+
+    NvmGroupCrcs( nvm, crcs );
+    if (memcmp( crcs, NvmGroupCrcPersisted, sizeof( crcs ) ) != 0) {
+        return true;
+    }
+
+    NvmCryptoUnamortized( nvm, &crypto );
+    if (memcmp( &crypto, &NvmCryptoPersisted, sizeof( crypto ) ) != 0) {
+        return true;
+    }
+
+    // also catches the counter reset of a new session
+    return ( nvm->Crypto.FCntList.FCntUp - FCntUpPersisted ) >= FCntPersistInterval;
+}
+
+/*!
+ * Skips the uplink frame counter restored from flash ahead by the interval
+ * it was persisted with, so no counter value is reused after a reboot
+ */
+static void NvmRestoreFCnt( void )
+{
+    LoRaMacNvmData_t* nvm = NvmContexts( );
+
+    // After a warm start the retained cache holds the exact counters. The
+    // crypto context is written at the start of the EEPROM, as laid out by
+    // NvmDataMgmtStore().
+    if (FCntPersistedInterval > 1 && !EepromMcuIsWarmStart()) {
+        nvm->Crypto.FCntList.FCntUp += FCntPersistedInterval;
+        nvm->Crypto.Crc32 = Crc32( ( uint8_t* )&nvm->Crypto, sizeof( nvm->Crypto ) - sizeof( nvm->Crypto.Crc32 ) );
+        EepromMcuWriteBuffer( 0, ( uint8_t* )&nvm->Crypto, sizeof( nvm->Crypto ) );
+        NvmRecordsChanged = true;
+    }
+
+    // The skipped counter, or a changed interval, must reach flash before
+    // the first uplink
+    if (NvmRecordsChanged || FCntPersistedInterval != FCntPersistInterval) {
+        NvmFlush( );
+    } else {
+        // The other contexts are flushed on every change, flash matches them
+        NvmGroupCrcs( nvm, NvmGroupCrcPersisted );
+        NvmCryptoUnamortized( nvm, &NvmCryptoPersisted );
+    }
+}
+
 static void OnNvmDataChange( LmHandlerNvmContextStates_t state, uint16_t size )
 {
-    if (Debug) {
-        DisplayNvmDataChange( state, size );
+    DebugLogRecord_t* record = DebugLogAlloc( DEBUG_LOG_NVM_DATA_CHANGE );
+
+    if (record != NULL) {
+        record->Params.NvmDataChange.State = state;
+        record->Params.NvmDataChange.Size = size;
+        DebugLogCommit( );
     }
 
-    EepromMcuFlush();
+    if (state == LORAMAC_HANDLER_NVM_RESTORE && EepromMcuIsWarmStart() &&
+        DebugLogAlloc( DEBUG_LOG_NVM_WARM_RESTORE ) != NULL) {
+        DebugLogCommit( );
+    }
+
+    if (state == LORAMAC_HANDLER_NVM_RESTORE) {
+        NvmRestoreFCnt();
+    } else if (NvmFlushRequired()) {
+        NvmFlush();
+    } else {
+        // Keep the retained copy valid for a warm start
+        EepromMcuRetain();
+    }
 }
 
 static void OnNetworkParametersChange( CommissioningParams_t* params )
@@ -719,50 +1644,658 @@ static void OnNetworkParametersChange( CommissioningParams_t* params )
         LoRaMacMibSetRequestConfirm( &mibReq );
     }
 
-    if (Debug) {
-        DisplayNetworkParametersUpdate( params );
+    DebugLogRecord_t* record = DebugLogAlloc( DEBUG_LOG_NETWORK_PARAMETERS );
+
+    if (record != NULL) {
+        record->Params.NetworkParameters = params;
+        DebugLogCommit( );
     }
 }
 
 static void OnMacMcpsRequest( LoRaMacStatus_t status, McpsReq_t *mcpsReq, TimerTime_t nextTxIn )
 {
-    if (Debug) {
-        DisplayMacMcpsRequestUpdate( status, mcpsReq, nextTxIn );
+    if (status == LORAMAC_STATUS_DUTYCYCLE_RESTRICTED) {
+        Stats.duty_cycle_deferrals++;
+        Stats.duty_cycle_deferred_ms += nextTxIn;
+    }
+
+    NextTxTime = make_timeout_time_ms( ( status == LORAMAC_STATUS_DUTYCYCLE_RESTRICTED ) ? nextTxIn : 0 );
+
+    DebugLogRecord_t* record = DebugLogAlloc( DEBUG_LOG_MCPS_REQUEST );
+
+    if (record != NULL) {
+        record->Params.McpsRequest.Status = status;
+        record->Params.McpsRequest.Request = *mcpsReq;
+        record->Params.McpsRequest.NextTxIn = nextTxIn;
+        DebugLogCommit( );
     }
 }
 
 static void OnMacMlmeRequest( LoRaMacStatus_t status, MlmeReq_t *mlmeReq, TimerTime_t nextTxIn )
 {
-    if (Debug) {
-        DisplayMacMlmeRequestUpdate( status, mlmeReq, nextTxIn );
+    NextTxTime = make_timeout_time_ms( ( status == LORAMAC_STATUS_DUTYCYCLE_RESTRICTED ) ? nextTxIn : 0 );
+
+    if (status == LORAMAC_STATUS_DUTYCYCLE_RESTRICTED) {
+        Stats.duty_cycle_deferrals++;
+        Stats.duty_cycle_deferred_ms += nextTxIn;
+    } else if (status == LORAMAC_STATUS_OK && mlmeReq->Type == MLME_JOIN) {
+        Stats.join_attempts++;
+    }
+
+    DebugLogRecord_t* record = DebugLogAlloc( DEBUG_LOG_MLME_REQUEST );
+
+    if (record != NULL) {
+        record->Params.MlmeRequest.Status = status;
+        record->Params.MlmeRequest.Request = *mlmeReq;
+        record->Params.MlmeRequest.NextTxIn = nextTxIn;
+        DebugLogCommit( );
+    }
+}
+
+static bool JoinNvmIsValid( void )
+{
+    return ( JoinNvm.Magic == LORAWAN_JOIN_NVM_MAGIC ) &&
+           ( JoinNvm.SubBand >= 1 ) && ( JoinNvm.SubBand <= LORAWAN_US915_SUB_BANDS ) &&
+           ( JoinNvm.Crc32 == Crc32( ( uint8_t* )&JoinNvm, sizeof( JoinNvm ) - sizeof( JoinNvm.Crc32 ) ) );
+}
+
+static bool JoinNvmMatches( uint8_t subBand, int8_t datarate )
+{
+    return JoinNvmIsValid( ) && ( JoinNvm.SubBand == subBand ) && ( JoinNvm.Datarate == datarate );
+}
+
+static uint32_t JoinStrategyCount( void )
+{
+    uint32_t numSubBands = ( JoinSettings->sub_bands != NULL ) ? JoinSettings->num_sub_bands : LORAWAN_US915_SUB_BANDS;
+    uint32_t numDatarates = ( JoinSettings->datarates != NULL ) ? JoinSettings->num_datarates : 1;
+
+    return numSubBands * numDatarates;
+}
+
+/*!
+ * Restricts the channel mask to the eight 125 kHz channels and the 500 kHz
+ * channel of a single US915 sub-band (1 - 8)
+ */
+static void JoinSetSubBand( uint8_t subBand )
+{
+    MibRequestConfirm_t mibReq;
+    uint16_t channelMask[6] = { 0 };
+
+    channelMask[( subBand - 1 ) / 2] = 0x00FF << ( 8 * ( ( subBand - 1 ) % 2 ) );
+    channelMask[4] = 1 << ( subBand - 1 );
+
+    if (!JoinDefaultMaskSaved) {
+        mibReq.Type = MIB_CHANNELS_DEFAULT_MASK;
+        LoRaMacMibGetRequestConfirm( &mibReq );
+        memcpy( JoinSavedDefaultMask, mibReq.Param.ChannelsDefaultMask, sizeof( JoinSavedDefaultMask ) );
+        JoinDefaultMaskSaved = true;
+    }
+
+    mibReq.Type = MIB_CHANNELS_MASK;
+    mibReq.Param.ChannelsMask = channelMask;
+    LoRaMacMibSetRequestConfirm( &mibReq );
+
+    mibReq.Type = MIB_CHANNELS_DEFAULT_MASK;
+    mibReq.Param.ChannelsDefaultMask = channelMask;
+    LoRaMacMibSetRequestConfirm( &mibReq );
+}
+
+/*!
+ * Restores the application's default channel mask once a join request is
+ * answered, the channel mask keeps the sub-band of the attempt
+ */
+static void JoinRestoreDefaultMask( void )
+{
+    MibRequestConfirm_t mibReq;
+
+    if (!JoinDefaultMaskSaved) {
+        return;
+    }
+
+    mibReq.Type = MIB_CHANNELS_DEFAULT_MASK;
+    mibReq.Param.ChannelsDefaultMask = JoinSavedDefaultMask;
+    LoRaMacMibSetRequestConfirm( &mibReq );
+
+    JoinDefaultMaskSaved = false;
+}
+
+/*!
+ * Sends the next join request of the configured strategy, the sub-band and
+ * data rate of the last successful join are tried first
+ */
+static void JoinNext( void )
+{
+    bool restored = JoinNvmIsValid( );
+    uint8_t subBand;
+    int8_t datarate;
+
+    if (restored && JoinAttempts == 0) {
+        subBand = JoinNvm.SubBand;
+        datarate = JoinNvm.Datarate;
+    } else {
+        uint32_t numDatarates = ( JoinSettings->datarates != NULL ) ? JoinSettings->num_datarates : 1;
+        uint32_t index = ( JoinAttempts - ( restored ? 1 : 0 ) ) % JoinStrategyCount( );
+
+        subBand = ( JoinSettings->sub_bands != NULL ) ? JoinSettings->sub_bands[index / numDatarates] : ( index / numDatarates ) + 1;
+        datarate = ( JoinSettings->datarates != NULL ) ? JoinSettings->datarates[index % numDatarates] : LORAWAN_DEFAULT_DATARATE;
+    }
+
+    JoinAttempts++;
+
+    // Sub-band hunting only applies to the regions with the US915 channel plan
+    if (LmHandlerParams.Region == LORAMAC_REGION_US915 || LmHandlerParams.Region == LORAMAC_REGION_AU915) {
+        JoinSubBand = subBand;
+        JoinSetSubBand( subBand );
+    } else {
+        JoinSubBand = 0;
+    }
+
+    JoinDatarate = datarate;
+
+    if (!JoinTxDatarateSaved) {
+        JoinSavedTxDatarate = LmHandlerParams.TxDatarate;
+        JoinTxDatarateSaved = true;
+    }
+    LmHandlerParams.TxDatarate = datarate;
+
+    DebugLogRecord_t* record = DebugLogAlloc( DEBUG_LOG_JOIN_ATTEMPT );
+
+    if (record != NULL) {
+        record->Params.JoinAttempt.Attempt = JoinAttempts;
+        record->Params.JoinAttempt.SubBand = JoinSubBand;
+        record->Params.JoinAttempt.Datarate = datarate;
+        DebugLogCommit( );
+    }
+
+    JoinRequest( );
+}
+
+/*!
+ * Delay before the next join request, doubled after each full rotation of the
+ * strategy up to the configured maximum, with up to 25% random jitter
+ */
+static uint32_t JoinBackoffMs( void )
+{
+    // no attempt of the strategy was sent if the join settings were set
+    // while a plain join was in progress
+    uint32_t rotations = ( JoinAttempts > 0 ) ? ( JoinAttempts - 1 ) / JoinStrategyCount( ) : 0;
+    uint32_t backoff = JoinSettings->backoff_min_ms;
+
+    while (rotations-- > 0 && backoff < JoinSettings->backoff_max_ms) {
+        if (backoff == 0) {
+            break;
+        }
+        backoff *= 2;
+    }
+
+    if (backoff > JoinSettings->backoff_max_ms) {
+        backoff = JoinSettings->backoff_max_ms;
+    }
+
+    if (backoff > 0) {
+        backoff += randr( 0, backoff / 4 );
+    }
+
+    return backoff;
+}
+
+static void JoinStart( void )
+{
+    TimerStop( &JoinBackoffTimer );
+    JoinRetryPending = false;
+    JoinAttempts = 0;
+
+    if (JoinSettings != NULL && OtaaSettings != NULL) {
+        JoinNext( );
+    } else {
+        JoinRequest( );
+    }
+}
+
+static void OnJoinBackoffTimerEvent( void* context )
+{
+    JoinRetryPending = true;
+    OnMacProcessNotify( );
+}
+
+/*!
+ * Clears the timeline at the start of an uplink
+ */
+static void TimelineBegin( void )
+{
+    memset( ( void* )&Timeline, 0, sizeof( Timeline ) );
+    TimelineRxWindow = 0;
+
+    Timeline.send_entry_us = time_us_32( );
+}
+
+static void OnRadioEvent( uint8_t event, uint32_t timestamp )
+{
+    switch( event )
+    {
+        case RADIO_EVENT_TX_START:
+            Timeline.tx_start_us = timestamp;
+            StatsTxStartUs = timestamp;
+            StatsTxCount++;
+            break;
+        case RADIO_EVENT_TX_DONE:
+            Timeline.tx_done_us = timestamp;
+            Stats.airtime_ms += ( timestamp - StatsTxStartUs + 500 ) / 1000;
+            TimelineRxWindow = 0;
+            break;
+        case RADIO_EVENT_RX_START:
+            TimelineRxWindow++;
+            if( TimelineRxWindow == 1 )
+            {
+                Timeline.rx1_open_us = timestamp;
+            }
+            else if( TimelineRxWindow == 2 )
+            {
+                Timeline.rx2_open_us = timestamp;
+            }
+            break;
+        case RADIO_EVENT_RX_END:
+            DownlinkRxEndUs = timestamp;
+            if( !ClockBoostRx )
+            {
+                ClockBoostRx = true;
+                BoardClockBoostBegin( );
+            }
+            if( TimelineRxWindow == 1 )
+            {
+                Timeline.rx1_close_us = timestamp;
+            }
+            else if( TimelineRxWindow == 2 )
+            {
+                Timeline.rx2_close_us = timestamp;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/*!
+ * Prints the timeline relative to the send call, outside of the radio
+ * and MAC processing
+ */
+static void DisplayTimeline( void )
+{
+    struct lorawan_timeline timeline;
+
+    lorawan_get_last_timeline( &timeline );
+
+    const uint32_t* steps = &timeline.send_entry_us;
+    const char* names[] =
+    {
+        "SEND", "ACCEPT", "TX START", "TX DONE", "RX1 OPEN", "RX1 CLOSE",
+        "RX2 OPEN", "RX2 CLOSE", "MCPS CONFIRM", "NVM FLUSH START", "NVM FLUSH END"
+    };
+
+    printf( "\n###### ===== UPLINK TIMELINE ==== ######\n" );
+    for( uint8_t i = 0; i < sizeof( names ) / sizeof( names[0] ); i++ )
+    {
+        if( steps[i] != 0 )
+        {
+            printf( "%-16s: %lu us\n", names[i], steps[i] - timeline.send_entry_us );
+        }
+    }
+    printf( "\n" );
+}
+
+/*!
+ * Returns the next free debug log record, NULL if debug output is disabled
+ * or the ring is full. The record is added by DebugLogCommit.
+ */
+static DebugLogRecord_t* DebugLogAlloc( DebugLogType_t type )
+{
+    if (!Debug) {
+        return NULL;
+    }
+
+    if ((DebugLogHead - DebugLogTail) >= LORAWAN_DEBUG_LOG_RECORDS) {
+        DebugLogDropped++;
+        return NULL;
+    }
+
+    DebugLogRecord_t* record = &DebugLog[DebugLogHead % LORAWAN_DEBUG_LOG_RECORDS];
+    record->Type = type;
+
+    return record;
+}
+
+static void DebugLogCommit( void )
+{
+    DebugLogHead++;
+}
+
+static void DebugLogDisplay( DebugLogRecord_t* record )
+{
+    switch( record->Type )
+    {
+        case DEBUG_LOG_NVM_DATA_CHANGE:
+            DisplayNvmDataChange( record->Params.NvmDataChange.State, record->Params.NvmDataChange.Size );
+            break;
+        case DEBUG_LOG_NVM_WARM_RESTORE:
+            printf( "###### ===== NVM RESTORED FROM RETAINED RAM ==== ######\n\n" );
+            break;
+        case DEBUG_LOG_NETWORK_PARAMETERS:
+            DisplayNetworkParametersUpdate( record->Params.NetworkParameters );
+            break;
+        case DEBUG_LOG_MCPS_REQUEST:
+            DisplayMacMcpsRequestUpdate( record->Params.McpsRequest.Status, &record->Params.McpsRequest.Request, record->Params.McpsRequest.NextTxIn );
+            break;
+        case DEBUG_LOG_MLME_REQUEST:
+            DisplayMacMlmeRequestUpdate( record->Params.MlmeRequest.Status, &record->Params.MlmeRequest.Request, record->Params.MlmeRequest.NextTxIn );
+            break;
+        case DEBUG_LOG_JOIN_ATTEMPT:
+            printf( "###### ===== JOIN ATTEMPT %lu: SUB-BAND %d, DR %d ==== ######\n", record->Params.JoinAttempt.Attempt,
+                    record->Params.JoinAttempt.SubBand, record->Params.JoinAttempt.Datarate );
+            break;
+        case DEBUG_LOG_JOIN_REQUEST:
+            DisplayJoinRequestUpdate( &record->Params.JoinRequest );
+            break;
+        case DEBUG_LOG_TX_DATA:
+            record->Params.TxData.AppData.Buffer = record->Data;
+            DisplayTxUpdate( &record->Params.TxData );
+            break;
+        case DEBUG_LOG_RX_DATA:
+            record->Params.RxData.AppData.Buffer = record->Data;
+            DisplayRxUpdate( &record->Params.RxData.AppData, &record->Params.RxData.Params );
+            break;
+        case DEBUG_LOG_CLASS_CHANGE:
+            DisplayClassUpdate( record->Params.ClassChange );
+            break;
+        case DEBUG_LOG_CLASS_REQUEST_FAILED:
+            printf( "###### ===== CLASS %c REQUEST FAILED ==== ######\n\n", "ABC"[record->Params.ClassRequestFailed] );
+            break;
+        case DEBUG_LOG_BEACON_STATUS:
+            DisplayBeaconUpdate( &record->Params.BeaconStatus );
+            break;
+        default:
+            break;
+    }
+}
+
+/*!
+ * Prints the recorded debug output, only while no uplink or RX window is
+ * in progress so printing can not delay the radio timing
+ */
+static void DebugLogProcess( void )
+{
+    while ((DebugLogTail != DebugLogHead) && !LmHandlerIsBusy( )) {
+        DebugLogDisplay( &DebugLog[DebugLogTail % LORAWAN_DEBUG_LOG_RECORDS] );
+        DebugLogTail++;
+    }
+
+    if (DebugLogDropped != 0 && DebugLogTail == DebugLogHead) {
+        printf( "###### ===== %lu DEBUG RECORDS DROPPED ==== ######\n\n", DebugLogDropped );
+        DebugLogDropped = 0;
+    }
+
+    if (TimelineDisplayPending && !LmHandlerIsBusy( )) {
+        TimelineDisplayPending = false;
+
+        DisplayTimeline( );
+    }
+}
+
+static bool ChannelMaskGet( uint16_t* mask, uint16_t size )
+{
+    MibRequestConfirm_t mibReq;
+
+    mibReq.Type = MIB_CHANNELS_MASK;
+    if (LoRaMacMibGetRequestConfirm( &mibReq ) != LORAMAC_STATUS_OK) {
+        return false;
+    }
+
+    memcpy1( ( uint8_t* )mask, ( uint8_t* )mibReq.Param.ChannelsMask, size );
+
+    return true;
+}
+
+static void ChannelMaskSet( uint16_t* mask )
+{
+    MibRequestConfirm_t mibReq;
+
+    mibReq.Type = MIB_CHANNELS_MASK;
+    mibReq.Param.ChannelsMask = mask;
+    LoRaMacMibSetRequestConfirm( &mibReq );
+}
+
+static bool ChannelMaskIsSet( const uint16_t* mask, uint8_t channel )
+{
+    return ( mask[channel / 16] & ( 1 << ( channel % 16 ) ) ) != 0;
+}
+
+/*!
+ * Excludes the 125 kHz channels acknowledged less often than configured
+ * from the channel mask, and brings them back every reprobe interval. A
+ * channel mask change by the network (LinkADRReq) becomes the new base.
+ */
+static void AdaptiveChannelsUpdate( void )
+{
+    uint16_t mask[LORAWAN_CHANNELS_MASK_SIZE];
+    uint8_t enabled = 0;
+
+    if (!ChannelMaskGet( mask, sizeof( mask ) )) {
+        return;
+    }
+
+    if (memcmp( mask, AdaptiveChannelsMask, sizeof( mask ) ) != 0) {
+        memcpy( AdaptiveChannelsBaseMask, mask, sizeof( mask ) );
+        memset( AdaptiveChannelsExcluded, 0, sizeof( AdaptiveChannelsExcluded ) );
+    }
+
+    AdaptiveChannelsUplinks++;
+    if (AdaptiveChannelsSettings->reprobe_uplinks != 0 &&
+        ( AdaptiveChannelsUplinks % AdaptiveChannelsSettings->reprobe_uplinks ) == 0) {
+        for (uint8_t i = 0; i < 64; i++) {
+            if (ChannelMaskIsSet( AdaptiveChannelsExcluded, i )) {
+                ChannelQuality[i].WindowUplinks = 0;
+                ChannelQuality[i].WindowAcks = 0;
+            }
+        }
+        memset( AdaptiveChannelsExcluded, 0, sizeof( AdaptiveChannelsExcluded ) );
+    }
+
+    for (uint8_t i = 0; i < 64; i++) {
+        if (ChannelMaskIsSet( AdaptiveChannelsBaseMask, i ) && !ChannelMaskIsSet( AdaptiveChannelsExcluded, i )) {
+            enabled++;
+        }
+    }
+
+    for (uint8_t i = 0; i < 64 && enabled > LORAWAN_ADAPTIVE_MIN_CHANNELS; i++) {
+        ChannelQuality_t* quality = &ChannelQuality[i];
+
+        if (!ChannelMaskIsSet( AdaptiveChannelsBaseMask, i ) || ChannelMaskIsSet( AdaptiveChannelsExcluded, i ) ||
+            quality->WindowUplinks < AdaptiveChannelsSettings->min_uplinks) {
+            continue;
+        }
+
+        if (( quality->WindowAcks * 100 ) < ( quality->WindowUplinks * AdaptiveChannelsSettings->min_ack_percent )) {
+            AdaptiveChannelsExcluded[i / 16] |= 1 << ( i % 16 );
+            enabled--;
+        }
+
+        quality->WindowUplinks = 0;
+        quality->WindowAcks = 0;
+    }
+
+    for (uint8_t i = 0; i < LORAWAN_CHANNELS_MASK_SIZE; i++) {
+        mask[i] = AdaptiveChannelsBaseMask[i] & ~AdaptiveChannelsExcluded[i];
+    }
+
+    if (memcmp( mask, AdaptiveChannelsMask, sizeof( mask ) ) != 0) {
+        memcpy( AdaptiveChannelsMask, mask, sizeof( mask ) );
+        ChannelMaskSet( mask );
+    }
+}
+
+static void ChannelQualityUpdate( LmHandlerTxParams_t* params )
+{
+    if (params->Channel >= LORAWAN_CHANNELS) {
+        return;
+    }
+
+    ChannelLast = params->Channel;
+
+    // Only acknowledged traffic tells if an uplink was delivered
+    if (params->MsgType == LORAMAC_HANDLER_CONFIRMED_MSG) {
+        ChannelQuality_t* quality = &ChannelQuality[params->Channel];
+
+        quality->Uplinks++;
+        quality->WindowUplinks++;
+        if (params->AckReceived == 1) {
+            quality->Acks++;
+            quality->WindowAcks++;
+        }
+    }
+
+    if (AdaptiveChannelsSettings != NULL) {
+        AdaptiveChannelsUpdate( );
+    }
+}
+
+/*!
+ * Handles the library events raised from timer or MAC callbacks
+ */
+static void ProcessPendingEvents( void )
+{
+    DebugLogProcess( );
+
+    if (JoinRetryPending) {
+        JoinRetryPending = false;
+
+        if (JoinSettings != NULL) {
+            JoinNext( );
+        } else {
+            JoinRequest( );
+        }
+    }
+
+    if (ClassRequestPending && !LmHandlerIsBusy( )) {
+        ClassRequestPending = false;
+
+        RequestClass( false );
+    }
+}
+
+/*!
+ * Switches to the class requested by the application, a refused request
+ * is recorded and, when retry is set, retried once the MAC is idle
+ */
+static void RequestClass( bool retry )
+{
+    if (LmHandlerRequestClass( RequestedClass ) == LORAMAC_HANDLER_SUCCESS) {
+        return;
+    }
+
+    DebugLogRecord_t* record = DebugLogAlloc( DEBUG_LOG_CLASS_REQUEST_FAILED );
+
+    if (record != NULL) {
+        record->Params.ClassRequestFailed = RequestedClass;
+        DebugLogCommit( );
+    }
+
+    if (retry) {
+        ClassRequestPending = true;
+        OnMacProcessNotify( );
     }
 }
 
 static void OnJoinRequest( LmHandlerJoinParams_t* params )
 {
-    if (Debug) {
-        DisplayJoinRequestUpdate( params );
+    DebugLogRecord_t* record = DebugLogAlloc( DEBUG_LOG_JOIN_REQUEST );
+
+    if (record != NULL) {
+        record->Params.JoinRequest = *params;
+        DebugLogCommit( );
     }
 
+    // a join request is not a retransmission of the next uplink
+    StatsTxCount = 0;
+
+    if (JoinTxDatarateSaved) {
+        LmHandlerParams.TxDatarate = JoinSavedTxDatarate;
+        JoinTxDatarateSaved = false;
+    }
+
+    JoinRestoreDefaultMask( );
+
     if( params->Status == LORAMAC_HANDLER_ERROR )
     {
-        LmHandlerJoin( );
+        if (JoinSettings == NULL) {
+            JoinRequest( );
+            return;
+        }
+
+        uint32_t backoff = JoinBackoffMs( );
+
+        if (backoff == 0) {
+            JoinRetryPending = true;
+            OnMacProcessNotify( );
+        } else {
+            TimerSetValue( &JoinBackoffTimer, backoff );
+            TimerStart( &JoinBackoffTimer );
+        }
     }
     else
     {
-        LmHandlerRequestClass( LORAWAN_DEFAULT_CLASS );
+        Stats.joins++;
+
+        if (JoinSettings != NULL && JoinSubBand != 0 && !JoinNvmMatches( JoinSubBand, JoinDatarate )) {
+            // Written to the EEPROM cache only, the NVM store that follows the
+            // join accept flushes it to flash
+            JoinNvm.Magic = LORAWAN_JOIN_NVM_MAGIC;
+            JoinNvm.SubBand = JoinSubBand;
+            JoinNvm.Datarate = JoinDatarate;
+            JoinNvm.Reserved = 0;
+            JoinNvm.Crc32 = Crc32( ( uint8_t* )&JoinNvm, sizeof( JoinNvm ) - sizeof( JoinNvm.Crc32 ) );
+
+            EepromMcuWriteBuffer( LORAWAN_JOIN_NVM_ADDR, ( uint8_t* )&JoinNvm, sizeof( JoinNvm ) );
+            NvmRecordsChanged = true;
+        }
+
+        RequestClass( true );
+
+#if USE_FREERTOS
+        xSemaphoreGive(xJoinDoneSemaphore);
+#endif
     }
 }
 
 static void OnTxData( LmHandlerTxParams_t* params )
 {
-    if (Debug) {
-        DisplayTxUpdate( params );
+    DebugLogRecord_t* record = DebugLogAlloc( DEBUG_LOG_TX_DATA );
+
+    if (record != NULL) {
+        // The payload may be gone by the time the record is printed
+        record->Params.TxData = *params;
+        record->Params.TxData.AppData.BufferSize = MIN( params->AppData.BufferSize, LORAWAN_DEBUG_LOG_DATA_SIZE );
+        memcpy1( record->Data, params->AppData.Buffer, record->Params.TxData.AppData.BufferSize );
+        DebugLogCommit( );
     }
     
     // Track if the last confirmed message was acknowledged
     if (params->IsMcpsConfirm == 1) {
         LastConfirmedMessageAcked = (params->AckReceived == 1);
+        NvmStats.uplinks++;
+
+        Stats.uplinks++;
+        if (params->MsgType == LORAMAC_HANDLER_CONFIRMED_MSG) {
+            Stats.confirmed_uplinks++;
+            Stats.acks += (params->AckReceived == 1);
+        }
+        if (StatsTxCount > 1) {
+            Stats.retransmissions += StatsTxCount - 1;
+        }
+        StatsTxCount = 0;
+
+        ChannelQualityUpdate( params );
+
+        Timeline.mcps_confirm_us = time_us_32( );
+        TimelineDisplayPending = Debug;
     }
     
 #if USE_FREERTOS
@@ -771,17 +2304,90 @@ static void OnTxData( LmHandlerTxParams_t* params )
 #endif
 }
 
+/*!
+ * LmHandler passes every downlink to OnRxData, including those on the port of
+ * a registered package, which the package has already handled
+ */
+static bool IsPackagePort( uint8_t port )
+{
+    static const struct
+    {
+        uint8_t Id;
+        LmhPackage_t* ( *Factory )( void );
+    } Packages[] =
+    {
+        { PACKAGE_ID_COMPLIANCE, LmhpCompliancePackageFactory },
+        { PACKAGE_ID_CLOCK_SYNC, LmhpClockSyncPackageFactory },
+        { PACKAGE_ID_REMOTE_MCAST_SETUP, LmhpRemoteMcastSetupPackageFactory },
+        { PACKAGE_ID_FRAGMENTATION, LmhpFragmentationPackageFactory },
+    };
+
+    for (uint32_t i = 0; i < sizeof(Packages) / sizeof(Packages[0]); i++) {
+        if (LmHandlerPackageIsInitialized( Packages[i].Id ) && Packages[i].Factory( )->Port == port) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 static void OnRxData( LmHandlerAppData_t* appData, LmHandlerRxParams_t* params )
 {
-    if (Debug) {
-        DisplayRxUpdate( appData, params );
+    if (Stats.downlinks == 0 || params->Rssi < Stats.rssi_min) {
+        Stats.rssi_min = params->Rssi;
+    }
+    if (Stats.downlinks == 0 || params->Rssi > Stats.rssi_max) {
+        Stats.rssi_max = params->Rssi;
+    }
+    if (Stats.downlinks == 0 || params->Snr < Stats.snr_min) {
+        Stats.snr_min = params->Snr;
+    }
+    if (Stats.downlinks == 0 || params->Snr > Stats.snr_max) {
+        Stats.snr_max = params->Snr;
+    }
+    StatsRssiSum += params->Rssi;
+    StatsSnrSum += params->Snr;
+
+    Stats.downlinks++;
+    Stats.downlinks_by_port[MIN(appData->Port, LORAWAN_STATS_PORTS - 1)]++;
+
+    // The MCPS confirm of the uplink is handled before the indication
+    ChannelQuality_t* quality = &ChannelQuality[ChannelLast];
+
+    if (quality->HasRx) {
+        quality->Rssi += ( params->Rssi - quality->Rssi ) / 4;
+        quality->Snr += ( params->Snr - quality->Snr ) / 4;
+    } else {
+        quality->Rssi = params->Rssi;
+        quality->Snr = params->Snr;
+        quality->HasRx = true;
+    }
+
+    DebugLogRecord_t* record = DebugLogAlloc( DEBUG_LOG_RX_DATA );
+
+    if (record != NULL) {
+        record->Params.RxData.AppData = *appData;
+        record->Params.RxData.AppData.BufferSize = MIN( appData->BufferSize, LORAWAN_DEBUG_LOG_DATA_SIZE );
+        record->Params.RxData.Params = *params;
+        memcpy1( record->Data, appData->Buffer, record->Params.RxData.AppData.BufferSize );
+        DebugLogCommit( );
     }
 
     // Handle regular application data
-    if (appData->BufferSize > 0) {
-        memcpy(AppRxData.Buffer, appData->Buffer, appData->BufferSize);
-        AppRxData.BufferSize = appData->BufferSize;
-        AppRxData.Port = appData->Port;
+    if (appData->BufferSize > 0 && !IsPackagePort( appData->Port )) {
+        if (DownlinkHead - DownlinkTail < LORAWAN_DOWNLINK_QUEUE_SIZE) {
+            Downlink_t* downlink = &DownlinkQueue[DownlinkHead % LORAWAN_DOWNLINK_QUEUE_SIZE];
+
+            memcpy(downlink->Buffer, appData->Buffer, appData->BufferSize);
+            downlink->BufferSize = appData->BufferSize;
+            downlink->Port = appData->Port;
+            downlink->RxEndUs = DownlinkRxEndUs;
+
+            DownlinkHead++;
+        } else {
+            // the oldest are kept, so the application sees downlinks in order
+            Stats.downlinks_dropped++;
+        }
     }
     
 #if USE_FREERTOS
@@ -792,8 +2398,15 @@ static void OnRxData( LmHandlerAppData_t* appData, LmHandlerRxParams_t* params )
 
 static void OnClassChange( DeviceClass_t deviceClass )
 {
-    if (Debug) {
-        DisplayClassUpdate( deviceClass );
+    DebugLogRecord_t* record = DebugLogAlloc( DEBUG_LOG_CLASS_CHANGE );
+
+    if (record != NULL) {
+        record->Params.ClassChange = deviceClass;
+        DebugLogCommit( );
+    }
+
+    if (deviceClass != CLASS_B) {
+        return;
     }
 
     // Inform the server as soon as possible that the end-device has switched to ClassB
@@ -803,7 +2416,7 @@ static void OnClassChange( DeviceClass_t deviceClass )
         .BufferSize = 0,
         .Port = 0,
     };
-    LmHandlerSend( &appData, LORAMAC_HANDLER_UNCONFIRMED_MSG );
+    SendRequest( &appData, LORAMAC_HANDLER_UNCONFIRMED_MSG );
 }
 
 static void OnBeaconStatusChange( LoRaMacHandlerBeaconParams_t* params )
@@ -825,8 +2438,11 @@ static void OnBeaconStatusChange( LoRaMacHandlerBeaconParams_t* params )
         }
     }
 
-    if (Debug) {
-        DisplayBeaconUpdate( params );
+    DebugLogRecord_t* record = DebugLogAlloc( DEBUG_LOG_BEACON_STATUS );
+
+    if (record != NULL) {
+        record->Params.BeaconStatus = *params;
+        DebugLogCommit( );
     }
 }
 
@@ -868,9 +2484,14 @@ static void prvLoRaWANTask(void *pvParameters)
     for (;;) {
         // Take mutex before processing LoRaWAN
         if (xSemaphoreTake(xLoRaWANMutex, portMAX_DELAY) == pdTRUE) {
-            
+            IsMacProcessPending = 0;
+
             // Process LoRaWAN MAC layer
             LmHandlerProcess();
+
+            ClockBoostRxEnd();
+
+            ProcessPendingEvents();
             
             // Release mutex
             xSemaphoreGive(xLoRaWANMutex);
@@ -890,6 +2511,7 @@ int lorawan_send_freertos(const void* data, size_t data_len, uint8_t app_port, b
     
     // Take mutex before sending
     if (xSemaphoreTake(xLoRaWANMutex, pdMS_TO_TICKS(timeout_ms)) == pdTRUE) {
+        TimelineBegin();
         
         // Prepare data
         AppData.Buffer = (uint8_t*)data;
@@ -903,7 +2525,11 @@ int lorawan_send_freertos(const void* data, size_t data_len, uint8_t app_port, b
         (void)xSemaphoreTake(xTxDoneSemaphore, 0);
         
         // Send the data
-    if (LmHandlerSend(&AppData, LmHandlerParams.IsTxConfirmed) == LORAMAC_HANDLER_SUCCESS) {
+        LmHandlerErrorStatus_t status = SendRequest(&AppData, LmHandlerParams.IsTxConfirmed);
+
+        if (status == LORAMAC_HANDLER_SUCCESS) {
+            Timeline.send_accept_us = time_us_32();
+
             // Release mutex so LoRaWAN task can process and invoke callbacks
             xSemaphoreGive(xLoRaWANMutex);
 
@@ -950,7 +2576,7 @@ int lorawan_join_freertos(uint32_t timeout_ms)
     if (xSemaphoreTake(xLoRaWANMutex, pdMS_TO_TICKS(timeout_ms)) == pdTRUE) {
         
         // Start join procedure
-        LmHandlerJoin();
+        JoinStart();
         
         // Join was initiated successfully
         result = 0;
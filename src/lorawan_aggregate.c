@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+#include <string.h>
+
+#include "pico/time.h"
+
+#include "pico/lorawan.h"
+#include "pico/lorawan_aggregate.h"
+
+// largest US915 application payload (DR4)
+#define AGGREGATE_BUFFER_SIZE 242
+
+static const struct lorawan_aggregate_settings* aggregate_settings = NULL;
+
+static uint8_t aggregate_buffer[AGGREGATE_BUFFER_SIZE];
+static uint8_t aggregate_length = 0;
+static uint8_t aggregate_records = 0;
+static absolute_time_t aggregate_deadline;
+
+static struct lorawan_aggregate_stats aggregate_stats;
+
+int lorawan_aggregate_init(const struct lorawan_aggregate_settings* settings)
+{
+    if (settings == NULL) {
+        return -1;
+    }
+
+    aggregate_settings = settings;
+    aggregate_length = 0;
+    aggregate_records = 0;
+    memset(&aggregate_stats, 0, sizeof(aggregate_stats));
+
+    return 0;
+}
+
+int lorawan_aggregate_flush()
+{
+    int8_t datarate;
+    int result;
+    uint8_t length = 0;
+    uint8_t records = 0;
+
+    if (aggregate_settings == NULL) {
+        return -1;
+    }
+
+    if (aggregate_length == 0) {
+        return 0;
+    }
+
+    // only whole records that fit the current data rate are sent, the data
+    // rate may have dropped since they were queued
+    int max_payload = lorawan_max_payload_now();
+
+    while (length < aggregate_length) {
+        uint8_t size = 1 + (aggregate_buffer[length] & 0x0f) + 1;
+
+        if (length + size > max_payload) {
+            break;
+        }
+
+        length += size;
+        records++;
+    }
+
+    if (length == 0) {
+        return -1;
+    }
+
+    if (aggregate_settings->confirmed) {
+        result = lorawan_send_confirmed(aggregate_buffer, length, aggregate_settings->app_port);
+    } else {
+        result = lorawan_send_unconfirmed(aggregate_buffer, length, aggregate_settings->app_port);
+    }
+
+    if (result != 0) {
+        // the records stay queued, lorawan_aggregate_process() retries
+        return -1;
+    }
+
+    if (lorawan_get_datarate(&datarate) == 0) {
+        int32_t time_on_air = lorawan_time_on_air(length, datarate);
+
+        if (time_on_air > 0) {
+            aggregate_stats.airtime_ms += time_on_air;
+        }
+    }
+
+    aggregate_stats.records += records;
+    aggregate_stats.uplinks++;
+
+    // the records left over are already due, so they keep their deadline
+    memmove(aggregate_buffer, &aggregate_buffer[length], aggregate_length - length);
+    aggregate_length -= length;
+    aggregate_records -= records;
+
+    return 0;
+}
+
+int lorawan_aggregate_append(uint8_t type, const void* data, uint8_t len, bool priority)
+{
+    if (aggregate_settings == NULL || data == NULL || type > LORAWAN_AGGREGATE_MAX_TYPE ||
+        len == 0 || len > LORAWAN_AGGREGATE_MAX_RECORD_SIZE) {
+        return -1;
+    }
+
+    int max_payload = lorawan_max_payload_now();
+    int size = 1 + len;
+
+    if (max_payload < size) {
+        return -1;
+    }
+
+    // send what is queued first if the record does not fit in the frame
+    if (aggregate_length + size > max_payload) {
+        lorawan_aggregate_flush();
+    }
+
+    if (aggregate_length + size > max_payload) {
+        // the queued records could not be sent yet
+        return -1;
+    }
+
+    if (aggregate_length == 0) {
+        aggregate_deadline = make_timeout_time_ms(aggregate_settings->max_latency_ms);
+    }
+
+    // one header byte per record: 4 bit type, 4 bit length - 1
+    aggregate_buffer[aggregate_length++] = (type << 4) | (len - 1);
+    memcpy(&aggregate_buffer[aggregate_length], data, len);
+    aggregate_length += len;
+    aggregate_records++;
+
+    if (priority || aggregate_length >= max_payload) {
+        lorawan_aggregate_flush();
+    }
+
+    return 0;
+}
+
+int lorawan_aggregate_process()
+{
+    if (aggregate_settings == NULL) {
+        return -1;
+    }
+
+    if (aggregate_length > 0 && (time_reached(aggregate_deadline) || aggregate_length >= lorawan_max_payload_now())) {
+        return lorawan_aggregate_flush();
+    }
+
+    return 0;
+}
+
+int lorawan_aggregate_get_stats(struct lorawan_aggregate_stats* stats)
+{
+    if (stats == NULL) {
+        return -1;
+    }
+
+    *stats = aggregate_stats;
+
+    return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+#include <string.h>
+
+#include "pico/time.h"
+
+#include "pico/lorawan.h"
+#include "pico/lorawan_bulk.h"
+
+#include "utilities.h"
+
+static const struct lorawan_bulk_settings* bulk_settings = NULL;
+
+static const uint8_t* bulk_data;
+static uint16_t bulk_size;
+static uint8_t bulk_id = 0;
+static uint8_t bulk_fragment_size;
+static uint16_t bulk_fragments;
+
+// position in the send order: data fragments of a group, then its parity fragment
+static uint16_t bulk_next_fragment;
+static bool bulk_next_parity;
+static uint16_t bulk_sent;
+static uint16_t bulk_total;
+
+static absolute_time_t bulk_next_time;
+
+static uint8_t bulk_frame[LORAWAN_BULK_HEADER_SIZE + 242];
+
+static void BulkComplete(int result)
+{
+    const struct lorawan_bulk_settings* settings = bulk_settings;
+
+    bulk_settings = NULL;
+
+    if (settings->complete != NULL) {
+        settings->complete(result, settings->context);
+    }
+}
+
+static uint8_t BulkFrame(uint16_t index, bool parity)
+{
+    uint16_t header_index = parity ? (index | LORAWAN_BULK_PARITY_FLAG) : index;
+
+    bulk_frame[0] = bulk_id;
+    bulk_frame[1] = bulk_settings->parity_group;
+    bulk_frame[2] = header_index & 0xff;
+    bulk_frame[3] = header_index >> 8;
+    bulk_frame[4] = bulk_size & 0xff;
+    bulk_frame[5] = bulk_size >> 8;
+
+    uint8_t* payload = &bulk_frame[LORAWAN_BULK_HEADER_SIZE];
+
+    memset(payload, 0, bulk_fragment_size);
+
+    if (!parity) {
+        uint32_t offset = index * bulk_fragment_size;
+        uint32_t len = MIN(bulk_fragment_size, bulk_size - offset);
+
+        memcpy(payload, bulk_data + offset, len);
+    } else {
+        // XOR of the group's data fragments, the last fragment zero padded
+        uint16_t first = index * bulk_settings->parity_group;
+        uint16_t last = MIN(first + bulk_settings->parity_group, bulk_fragments);
+
+        for (uint16_t fragment = first; fragment < last; fragment++) {
+            uint32_t offset = fragment * bulk_fragment_size;
+            uint32_t len = MIN(bulk_fragment_size, bulk_size - offset);
+
+            for (uint32_t i = 0; i < len; i++) {
+                payload[i] ^= bulk_data[offset + i];
+            }
+        }
+    }
+
+    return LORAWAN_BULK_HEADER_SIZE + bulk_fragment_size;
+}
+
+int lorawan_bulk_send(const struct lorawan_bulk_settings* settings, const void* data, uint16_t size)
+{
+    if (bulk_settings != NULL || settings == NULL || data == NULL || size == 0) {
+        return -1;
+    }
+
+    // the fragment size is fixed for the transfer so parity can be computed over it
+    int max_payload = lorawan_max_payload_now();
+
+    if (max_payload <= LORAWAN_BULK_HEADER_SIZE) {
+        return -1;
+    }
+
+    uint8_t fragment_size = MIN(max_payload - LORAWAN_BULK_HEADER_SIZE, sizeof(bulk_frame) - LORAWAN_BULK_HEADER_SIZE);
+    uint16_t fragments = (size + fragment_size - 1) / fragment_size;
+
+    if (fragments > LORAWAN_BULK_MAX_FRAGMENTS) {
+        return -1;
+    }
+
+    bulk_settings = settings;
+    bulk_data = data;
+    bulk_size = size;
+    bulk_id++;
+    bulk_fragment_size = fragment_size;
+    bulk_fragments = fragments;
+
+    bulk_next_fragment = 0;
+    bulk_next_parity = false;
+    bulk_sent = 0;
+    bulk_total = fragments;
+
+    if (settings->parity_group != 0) {
+        bulk_total += (fragments + settings->parity_group - 1) / settings->parity_group;
+    }
+
+    bulk_next_time = get_absolute_time();
+
+    return 0;
+}
+
+int lorawan_bulk_process()
+{
+    if (bulk_settings == NULL) {
+        return 0;
+    }
+
+    if (!lorawan_is_joined() || !time_reached(bulk_next_time) || lorawan_next_tx_in_ms() != 0) {
+        return 0;
+    }
+
+    if (lorawan_max_payload_now() < LORAWAN_BULK_HEADER_SIZE + bulk_fragment_size) {
+        // the data rate dropped below the transfer's fragment size
+        BulkComplete(-1);
+
+        return -1;
+    }
+
+    uint16_t index = bulk_next_parity ? (bulk_next_fragment - 1) / bulk_settings->parity_group : bulk_next_fragment;
+    uint8_t len = BulkFrame(index, bulk_next_parity);
+
+    if (lorawan_send_unconfirmed(bulk_frame, len, bulk_settings->app_port) != 0) {
+        // retried on the next call
+        return -1;
+    }
+
+    bulk_next_time = make_timeout_time_ms(bulk_settings->interval_ms);
+    bulk_sent++;
+
+    if (bulk_next_parity) {
+        bulk_next_parity = false;
+    } else {
+        bulk_next_fragment++;
+
+        bulk_next_parity = (bulk_settings->parity_group != 0) &&
+                           ((bulk_next_fragment % bulk_settings->parity_group) == 0 || bulk_next_fragment == bulk_fragments);
+    }
+
+    if (bulk_settings->progress != NULL) {
+        bulk_settings->progress(bulk_sent, bulk_total, bulk_settings->context);
+    }
+
+    if (bulk_sent == bulk_total) {
+        BulkComplete(0);
+    }
+
+    return 0;
+}
+
+bool lorawan_bulk_busy()
+{
+    return (bulk_settings != NULL);
+}
+
+void lorawan_bulk_cancel()
+{
+    if (bulk_settings != NULL) {
+        BulkComplete(-1);
+    }
+}
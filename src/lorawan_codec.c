@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+// only depends on the C library, so the same file can be built on a host to decode uplinks
+
+#include <string.h>
+
+#include "pico/lorawan_codec.h"
+
+// frame header: keyframe flag and 7 bit sequence number
+#define CODEC_HEADER_KEYFRAME 0x80
+#define CODEC_HEADER_SEQUENCE_MASK 0x7f
+
+typedef struct {
+    uint8_t* buffer;
+    uint16_t size;
+    uint32_t bit;
+} BitWriter_t;
+
+typedef struct {
+    const uint8_t* buffer;
+    uint16_t size;
+    uint32_t bit;
+} BitReader_t;
+
+static bool BitWrite(BitWriter_t* writer, uint32_t value, uint8_t bits)
+{
+    if ((writer->bit + bits) > (writer->size * 8u)) {
+        return false;
+    }
+
+    while (bits > 0) {
+        bits--;
+
+        uint8_t mask = 0x80 >> (writer->bit & 7);
+
+        if ((value >> bits) & 1) {
+            writer->buffer[writer->bit >> 3] |= mask;
+        } else {
+            writer->buffer[writer->bit >> 3] &= ~mask;
+        }
+
+        writer->bit++;
+    }
+
+    return true;
+}
+
+static bool BitRead(BitReader_t* reader, uint32_t* value, uint8_t bits)
+{
+    if ((reader->bit + bits) > (reader->size * 8u)) {
+        return false;
+    }
+
+    *value = 0;
+
+    while (bits > 0) {
+        bits--;
+
+        uint8_t mask = 0x80 >> (reader->bit & 7);
+
+        *value = (*value << 1) | ((reader->buffer[reader->bit >> 3] & mask) ? 1 : 0);
+
+        reader->bit++;
+    }
+
+    return true;
+}
+
+static uint32_t ZigZagEncode(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t ZigZagDecode(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// 7 bits per group, high bit set when another group follows
+static bool VarintWrite(BitWriter_t* writer, uint32_t value)
+{
+    while (value > 0x7f) {
+        if (!BitWrite(writer, 0x80 | (value & 0x7f), 8)) {
+            return false;
+        }
+
+        value >>= 7;
+    }
+
+    return BitWrite(writer, value, 8);
+}
+
+static bool VarintRead(BitReader_t* reader, uint32_t* value)
+{
+    uint32_t group;
+    uint8_t shift = 0;
+
+    *value = 0;
+
+    do {
+        if (shift > 28 || !BitRead(reader, &group, 8)) {
+            return false;
+        }
+
+        *value |= (group & 0x7f) << shift;
+        shift += 7;
+    } while (group & 0x80);
+
+    return true;
+}
+
+int lorawan_codec_init(struct lorawan_codec* codec, const struct lorawan_codec_channel* channels, uint8_t channel_count, uint8_t keyframe_interval)
+{
+    if (codec == NULL || channels == NULL || channel_count == 0 || channel_count > LORAWAN_CODEC_MAX_CHANNELS) {
+        return -1;
+    }
+
+    for (int i = 0; i < channel_count; i++) {
+        if (channels[i].encoding > LORAWAN_CODEC_FIXED) {
+            return -1;
+        }
+
+        if (channels[i].encoding == LORAWAN_CODEC_FIXED && (channels[i].bits == 0 || channels[i].bits > 32)) {
+            return -1;
+        }
+    }
+
+    memset(codec, 0, sizeof(*codec));
+
+    codec->channels = channels;
+    codec->channel_count = channel_count;
+    codec->keyframe_interval = keyframe_interval;
+
+    return 0;
+}
+
+void lorawan_codec_force_keyframe(struct lorawan_codec* codec)
+{
+    codec->synced = false;
+}
+
+int lorawan_codec_encode(struct lorawan_codec* codec, const int32_t* values, uint8_t* buffer, uint8_t buffer_len)
+{
+    if (codec == NULL || values == NULL || buffer == NULL || buffer_len == 0) {
+        return -1;
+    }
+
+    bool keyframe = !codec->synced ||
+                    (codec->keyframe_interval != 0 && codec->frames_since_keyframe >= codec->keyframe_interval);
+
+    BitWriter_t writer = { buffer, buffer_len, 0 };
+
+    BitWrite(&writer, (keyframe ? CODEC_HEADER_KEYFRAME : 0) | (codec->sequence & CODEC_HEADER_SEQUENCE_MASK), 8);
+
+    for (int i = 0; i < codec->channel_count; i++) {
+        const struct lorawan_codec_channel* channel = &codec->channels[i];
+        bool written;
+
+        switch (channel->encoding) {
+            case LORAWAN_CODEC_DELTA:
+                if (!keyframe) {
+                    written = VarintWrite(&writer, ZigZagEncode(values[i] - codec->previous[i]));
+                    break;
+                }
+                // keyframes carry the value
+                // fall through
+            case LORAWAN_CODEC_VARINT:
+                written = VarintWrite(&writer, ZigZagEncode(values[i]));
+                break;
+
+            case LORAWAN_CODEC_FIXED:
+            default: {
+                // clamp to the range the channel's bits can hold
+                uint32_t max = (channel->bits == 32) ? UINT32_MAX : ((1u << channel->bits) - 1);
+                int64_t offset = (int64_t)values[i] - channel->min;
+
+                if (offset < 0) {
+                    offset = 0;
+                } else if (offset > max) {
+                    offset = max;
+                }
+
+                written = BitWrite(&writer, (uint32_t)offset, channel->bits);
+                break;
+            }
+        }
+
+        if (!written) {
+            return -1;
+        }
+    }
+
+    // only advance the history once the whole frame fits
+    memcpy(codec->previous, values, codec->channel_count * sizeof(values[0]));
+
+    codec->sequence = (codec->sequence + 1) & CODEC_HEADER_SEQUENCE_MASK;
+    codec->frames_since_keyframe = keyframe ? 1 : (codec->frames_since_keyframe + 1);
+    codec->synced = true;
+
+    // pad the last byte with zeros
+    while (writer.bit & 7) {
+        BitWrite(&writer, 0, 1);
+    }
+
+    return writer.bit / 8;
+}
+
+int lorawan_codec_decode(struct lorawan_codec* codec, const uint8_t* buffer, uint8_t len, int32_t* values)
+{
+    if (codec == NULL || buffer == NULL || values == NULL) {
+        return -1;
+    }
+
+    BitReader_t reader = { buffer, len, 0 };
+    uint32_t header;
+
+    if (!BitRead(&reader, &header, 8)) {
+        return -1;
+    }
+
+    bool keyframe = (header & CODEC_HEADER_KEYFRAME) != 0;
+    uint8_t sequence = header & CODEC_HEADER_SEQUENCE_MASK;
+
+    // a delta frame can only be applied directly after the frame it was encoded against
+    if (!keyframe && (!codec->synced || sequence != codec->sequence)) {
+        codec->synced = false;
+        return -1;
+    }
+
+    int32_t decoded[LORAWAN_CODEC_MAX_CHANNELS];
+
+    for (int i = 0; i < codec->channel_count; i++) {
+        const struct lorawan_codec_channel* channel = &codec->channels[i];
+        uint32_t value;
+
+        if (channel->encoding == LORAWAN_CODEC_FIXED) {
+            if (!BitRead(&reader, &value, channel->bits)) {
+                return -1;
+            }
+
+            decoded[i] = (int32_t)(channel->min + value);
+        } else {
+            if (!VarintRead(&reader, &value)) {
+                return -1;
+            }
+
+            decoded[i] = ZigZagDecode(value);
+
+            if (channel->encoding == LORAWAN_CODEC_DELTA && !keyframe) {
+                decoded[i] += codec->previous[i];
+            }
+        }
+    }
+
+    memcpy(codec->previous, decoded, codec->channel_count * sizeof(decoded[0]));
+    memcpy(values, decoded, codec->channel_count * sizeof(decoded[0]));
+
+    codec->sequence = (sequence + 1) & CODEC_HEADER_SEQUENCE_MASK;
+    codec->synced = true;
+
+    return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+
+#include "pico/lorawan.h"
+#include "pico/lorawan_fuota.h"
+
+#include "board.h"
+#include "utilities.h"
+
+#include "LmHandler.h"
+#include "LmhpClockSync.h"
+#include "LmhpFragmentation.h"
+#include "LmhpRemoteMcastSetup.h"
+
+#if LORAWAN_FUOTA
+
+#define FUOTA_OFFSET  (PICO_FLASH_SIZE_BYTES - (LORAWAN_NVM_SECTORS * FLASH_SECTOR_SIZE) - (LORAWAN_QUEUE_SECTORS * FLASH_SECTOR_SIZE) - LORAWAN_FUOTA_STORE_SIZE)
+#define FUOTA_ADDRESS ((const uint8_t*)(XIP_BASE + FUOTA_OFFSET))
+
+#define FUOTA_SECTOR_NONE 0xffffffff
+
+_Static_assert((LORAWAN_FUOTA_STORE_SIZE % FLASH_SECTOR_SIZE) == 0, "the FUOTA store must be a whole number of flash sectors");
+
+static int8_t FragDecoderWrite( uint32_t addr, uint8_t *data, uint32_t size );
+static int8_t FragDecoderRead( uint32_t addr, uint8_t *data, uint32_t size );
+static void OnFragProgress( uint16_t fragCounter, uint16_t fragNb, uint8_t fragSize, uint16_t fragNbLost );
+static void OnFragDone( int32_t status, uint32_t size );
+
+static LmhpFragmentationParams_t FragmentationParams =
+{
+    .DecoderCallbacks =
+    {
+        .FragDecoderWrite = FragDecoderWrite,
+        .FragDecoderRead = FragDecoderRead,
+    },
+    .OnProgress = OnFragProgress,
+    .OnDone = OnFragDone
+};
+
+extern char __flash_binary_end;
+
+static const struct lorawan_fuota_settings* fuota_settings = NULL;
+
+// The decoder writes fragments mostly in order, but also reads back and
+// rewrites rows while recovering lost ones. Writes go to a single cached
+// sector, which is only written to flash when another sector is accessed
+// or the transfer is done.
+static uint8_t fuota_sector[FLASH_SECTOR_SIZE];
+static uint32_t fuota_sector_index = FUOTA_SECTOR_NONE;
+static bool fuota_sector_dirty = false;
+
+static void FuotaSectorFlush()
+{
+    uint32_t offset;
+    const uint8_t* flash;
+    bool erase = false;
+
+    if (fuota_sector_index == FUOTA_SECTOR_NONE || !fuota_sector_dirty) {
+        return;
+    }
+
+    offset = FUOTA_OFFSET + fuota_sector_index * FLASH_SECTOR_SIZE;
+    flash = FUOTA_ADDRESS + fuota_sector_index * FLASH_SECTOR_SIZE;
+
+    // programming can only clear bits, only erase if a bit needs to be set
+    for (uint32_t i = 0; i < FLASH_SECTOR_SIZE; i++) {
+        if ((flash[i] & fuota_sector[i]) != fuota_sector[i]) {
+            erase = true;
+            break;
+        }
+    }
+
+    CRITICAL_SECTION_BEGIN( );
+
+    if (erase) {
+        flash_range_erase(offset, FLASH_SECTOR_SIZE);
+    }
+
+    // only the pages that changed are programmed
+    for (uint32_t page = 0; page < FLASH_SECTOR_SIZE; page += FLASH_PAGE_SIZE) {
+        if (erase || memcmp(flash + page, fuota_sector + page, FLASH_PAGE_SIZE) != 0) {
+            flash_range_program(offset + page, fuota_sector + page, FLASH_PAGE_SIZE);
+        }
+    }
+
+    CRITICAL_SECTION_END( );
+
+    fuota_sector_dirty = false;
+}
+
+static uint8_t* FuotaSector(uint32_t sector)
+{
+    if (sector != fuota_sector_index) {
+        FuotaSectorFlush();
+
+        memcpy(fuota_sector, FUOTA_ADDRESS + sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+        fuota_sector_index = sector;
+    }
+
+    return fuota_sector;
+}
+
+static int8_t FragDecoderWrite( uint32_t addr, uint8_t *data, uint32_t size )
+{
+    if (addr + size > LORAWAN_FUOTA_STORE_SIZE) {
+        return -1;
+    }
+
+    while (size > 0) {
+        uint32_t offset = addr % FLASH_SECTOR_SIZE;
+        uint32_t len = MIN(size, FLASH_SECTOR_SIZE - offset);
+
+        memcpy(FuotaSector(addr / FLASH_SECTOR_SIZE) + offset, data, len);
+        fuota_sector_dirty = true;
+
+        addr += len;
+        data += len;
+        size -= len;
+    }
+
+    return 0;
+}
+
+static int8_t FragDecoderRead( uint32_t addr, uint8_t *data, uint32_t size )
+{
+    if (addr + size > LORAWAN_FUOTA_STORE_SIZE) {
+        return -1;
+    }
+
+    while (size > 0) {
+        uint32_t sector = addr / FLASH_SECTOR_SIZE;
+        uint32_t offset = addr % FLASH_SECTOR_SIZE;
+        uint32_t len = MIN(size, FLASH_SECTOR_SIZE - offset);
+
+        // reads do not need to evict the cached sector
+        if (sector == fuota_sector_index) {
+            memcpy(data, fuota_sector + offset, len);
+        } else {
+            memcpy(data, FUOTA_ADDRESS + addr, len);
+        }
+
+        addr += len;
+        data += len;
+        size -= len;
+    }
+
+    return 0;
+}
+
+static void OnFragProgress( uint16_t fragCounter, uint16_t fragNb, uint8_t fragSize, uint16_t fragNbLost )
+{
+    if (fuota_settings->progress != NULL) {
+        fuota_settings->progress(fragCounter, fragNb, fragNbLost, fuota_settings->context);
+    }
+}
+
+static void OnFragDone( int32_t status, uint32_t size )
+{
+    FuotaSectorFlush();
+
+    if (fuota_settings->complete != NULL) {
+        fuota_settings->complete(status, size, fuota_settings->context);
+    }
+}
+
+int lorawan_fuota_init(const struct lorawan_fuota_settings* settings)
+{
+    if (settings == NULL) {
+        return -1;
+    }
+
+    // the program must end below the fragment store, or receiving would erase it
+    if ((uintptr_t)&__flash_binary_end > (uintptr_t)FUOTA_ADDRESS) {
+        return -1;
+    }
+
+    fuota_settings = settings;
+
+    if (LmHandlerPackageRegister( PACKAGE_ID_CLOCK_SYNC, NULL ) != LORAMAC_HANDLER_SUCCESS ||
+        LmHandlerPackageRegister( PACKAGE_ID_REMOTE_MCAST_SETUP, NULL ) != LORAMAC_HANDLER_SUCCESS ||
+        LmHandlerPackageRegister( PACKAGE_ID_FRAGMENTATION, &FragmentationParams ) != LORAMAC_HANDLER_SUCCESS) {
+        return -1;
+    }
+
+    return 0;
+}
+
+const uint8_t* lorawan_fuota_image()
+{
+    return FUOTA_ADDRESS;
+}
+
+int lorawan_fuota_erase()
+{
+    fuota_sector_index = FUOTA_SECTOR_NONE;
+    fuota_sector_dirty = false;
+
+    // a sector at a time, so interrupts are not held off for the whole region
+    for (uint32_t offset = 0; offset < LORAWAN_FUOTA_STORE_SIZE; offset += FLASH_SECTOR_SIZE) {
+        CRITICAL_SECTION_BEGIN( );
+
+        flash_range_erase(FUOTA_OFFSET + offset, FLASH_SECTOR_SIZE);
+
+        CRITICAL_SECTION_END( );
+    }
+
+    return 0;
+}
+
+#else
+
+int lorawan_fuota_init(const struct lorawan_fuota_settings* settings)
+{
+    // build with LORAWAN_FUOTA enabled
+    return -1;
+}
+
+const uint8_t* lorawan_fuota_image()
+{
+    return NULL;
+}
+
+int lorawan_fuota_erase()
+{
+    return -1;
+}
+
+#endif
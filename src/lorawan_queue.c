@@ -0,0 +1,384 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+
+#include "pico/lorawan.h"
+#include "pico/lorawan_queue.h"
+
+#include "board.h"
+#include "utilities.h"
+
+// The queue is a circular log of one record per flash page in the sectors
+// directly below the NVM sectors at the end of flash. Appending
+// programs a single page, a sector is only erased when the log wraps into
+// it, and a sent record is marked by programming its consumed byte to 0.
+#define QUEUE_SIZE              (LORAWAN_QUEUE_SECTORS * FLASH_SECTOR_SIZE)
+#define QUEUE_OFFSET            (PICO_FLASH_SIZE_BYTES - (LORAWAN_NVM_SECTORS * FLASH_SECTOR_SIZE) - QUEUE_SIZE)
+#define QUEUE_ADDRESS           ((const uint8_t*)(XIP_BASE + QUEUE_OFFSET))
+
+#define QUEUE_SLOTS             (QUEUE_SIZE / FLASH_PAGE_SIZE)
+#define QUEUE_SLOTS_PER_SECTOR  (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+
+// one sector is always reserved for the log to wrap into
+#define QUEUE_CAPACITY          (QUEUE_SLOTS - QUEUE_SLOTS_PER_SECTOR)
+
+#define QUEUE_MAX_PAYLOAD       242
+
+#define QUEUE_FLAG_CONFIRMED    0x01
+
+typedef struct {
+    uint32_t Sequence;
+    uint8_t Length;
+    uint8_t AppPort;
+    uint8_t Flags;
+    uint8_t Priority;
+    uint8_t Data[QUEUE_MAX_PAYLOAD];
+    // not covered by the CRC, programmed to 0x00 once sent
+    uint8_t Consumed;
+    uint8_t Reserved;
+    uint32_t Crc32;
+} QueueRecord_t;
+
+_Static_assert(sizeof(QueueRecord_t) == FLASH_PAGE_SIZE, "a queue record must fill one flash page");
+
+#define QUEUE_RECORD_CRC_SIZE   offsetof(QueueRecord_t, Consumed)
+
+extern char __flash_binary_end;
+
+static const struct lorawan_queue_settings* queue_settings = NULL;
+
+static uint16_t queue_write_slot = 0;
+static uint32_t queue_sequence = 0;
+static uint16_t queue_pending = 0;
+
+// pending slots, found once on init so the records are not CRC checked
+// through XIP on every call
+static uint32_t queue_pending_slots[(QUEUE_SLOTS + 31) / 32];
+
+static QueueRecord_t queue_record;
+
+static struct lorawan_queue_stats queue_stats;
+
+static const QueueRecord_t* QueueSlot(uint16_t slot)
+{
+    return (const QueueRecord_t*)(QUEUE_ADDRESS + slot * FLASH_PAGE_SIZE);
+}
+
+static bool QueueSlotIsErased(uint16_t slot)
+{
+    const uint32_t* words = (const uint32_t*)QueueSlot(slot);
+
+    for (int i = 0; i < FLASH_PAGE_SIZE / sizeof(uint32_t); i++) {
+        if (words[i] != 0xffffffff) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// a page torn by a power failure fails the CRC and is skipped
+static bool QueueSlotIsValid(uint16_t slot)
+{
+    const QueueRecord_t* record = QueueSlot(slot);
+
+    return (record->Length <= QUEUE_MAX_PAYLOAD) &&
+           (record->Crc32 == Crc32((uint8_t*)record, QUEUE_RECORD_CRC_SIZE));
+}
+
+static bool QueueSlotIsPending(uint16_t slot)
+{
+    return (queue_pending_slots[slot / 32] >> (slot % 32)) & 1;
+}
+
+static void QueueSlotSetPending(uint16_t slot, bool pending)
+{
+    if (pending) {
+        queue_pending_slots[slot / 32] |= 1u << (slot % 32);
+    } else {
+        queue_pending_slots[slot / 32] &= ~(1u << (slot % 32));
+    }
+}
+
+static void QueueProgram(uint32_t offset, const uint8_t* data)
+{
+    CRITICAL_SECTION_BEGIN( );
+
+    flash_range_program(QUEUE_OFFSET + offset, data, FLASH_PAGE_SIZE);
+
+    CRITICAL_SECTION_END( );
+
+    queue_stats.flash_programs++;
+}
+
+static void QueueEraseSector(uint16_t sector)
+{
+    CRITICAL_SECTION_BEGIN( );
+
+    flash_range_erase(QUEUE_OFFSET + sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+
+    CRITICAL_SECTION_END( );
+
+    queue_stats.flash_erases++;
+}
+
+static void QueueConsume(uint16_t slot)
+{
+    // programming only clears bits, so every other byte is left as it is
+    memset(&queue_record, 0xff, sizeof(queue_record));
+    queue_record.Consumed = 0x00;
+
+    QueueProgram(slot * FLASH_PAGE_SIZE, (uint8_t*)&queue_record);
+
+    QueueSlotSetPending(slot, false);
+    queue_pending--;
+}
+
+// the record at the head of the queue, in the configured order unless oldest
+static int QueueNext(bool oldest)
+{
+    int next = -1;
+
+    for (uint16_t slot = 0; slot < QUEUE_SLOTS; slot++) {
+        if (!QueueSlotIsPending(slot)) {
+            continue;
+        }
+
+        if (next < 0) {
+            next = slot;
+            continue;
+        }
+
+        const QueueRecord_t* record = QueueSlot(slot);
+        const QueueRecord_t* best = QueueSlot(next);
+
+        if (!oldest && queue_settings->order == LORAWAN_QUEUE_PRIORITY && record->Priority != best->Priority) {
+            if (record->Priority > best->Priority) {
+                next = slot;
+            }
+        } else if (record->Sequence < best->Sequence) {
+            next = slot;
+        }
+    }
+
+    return next;
+}
+
+// finds the next erased slot, erasing the sector the log wraps into
+static int QueueWritableSlot()
+{
+    for (int i = 0; i < QUEUE_SLOTS; i++) {
+        uint16_t slot = queue_write_slot;
+
+        if ((slot % QUEUE_SLOTS_PER_SECTOR) == 0) {
+            uint16_t pending = 0;
+            bool erased = true;
+
+            for (uint16_t s = slot; s < slot + QUEUE_SLOTS_PER_SECTOR; s++) {
+                pending += QueueSlotIsPending(s);
+                erased &= QueueSlotIsErased(s);
+            }
+
+            if (!erased) {
+                if (pending != 0 && queue_settings->drop_policy == LORAWAN_QUEUE_DROP_NEWEST) {
+                    return -1;
+                }
+
+                QueueEraseSector(slot / QUEUE_SLOTS_PER_SECTOR);
+
+                for (uint16_t s = slot; s < slot + QUEUE_SLOTS_PER_SECTOR; s++) {
+                    QueueSlotSetPending(s, false);
+                }
+
+                queue_pending -= pending;
+                queue_stats.dropped += pending;
+            }
+        }
+
+        queue_write_slot = (queue_write_slot + 1) % QUEUE_SLOTS;
+
+        if (QueueSlotIsErased(slot)) {
+            return slot;
+        }
+    }
+
+    return -1;
+}
+
+int lorawan_queue_init(const struct lorawan_queue_settings* settings)
+{
+    if (settings == NULL || settings->capacity > QUEUE_CAPACITY) {
+        return -1;
+    }
+
+    // the program must end below the queue, or appending would erase it
+    if ((uintptr_t)&__flash_binary_end > (uintptr_t)QUEUE_ADDRESS) {
+        return -1;
+    }
+
+    queue_settings = settings;
+
+    memset(&queue_stats, 0, sizeof(queue_stats));
+
+    queue_write_slot = 0;
+    queue_sequence = 0;
+    queue_pending = 0;
+
+    memset(queue_pending_slots, 0, sizeof(queue_pending_slots));
+
+    // resume after the newest record
+    for (uint16_t slot = 0; slot < QUEUE_SLOTS; slot++) {
+        if (!QueueSlotIsValid(slot)) {
+            continue;
+        }
+
+        const QueueRecord_t* record = QueueSlot(slot);
+
+        if (record->Sequence >= queue_sequence) {
+            queue_sequence = record->Sequence + 1;
+            queue_write_slot = (slot + 1) % QUEUE_SLOTS;
+        }
+
+        if (record->Consumed == 0xff) {
+            QueueSlotSetPending(slot, true);
+            queue_pending++;
+        }
+    }
+
+    return 0;
+}
+
+int lorawan_queue_append(const void* data, uint8_t data_len, uint8_t app_port, bool confirmed, uint8_t priority)
+{
+    if (queue_settings == NULL || data == NULL || data_len > QUEUE_MAX_PAYLOAD) {
+        return -1;
+    }
+
+    uint16_t capacity = queue_settings->capacity ? queue_settings->capacity : QUEUE_CAPACITY;
+
+    if (queue_pending >= capacity) {
+        if (queue_settings->drop_policy == LORAWAN_QUEUE_DROP_NEWEST) {
+            queue_stats.dropped++;
+
+            return -1;
+        }
+
+        int oldest = QueueNext(true);
+
+        if (oldest >= 0) {
+            QueueConsume(oldest);
+        }
+
+        queue_stats.dropped++;
+    }
+
+    int slot = QueueWritableSlot();
+
+    if (slot < 0) {
+        queue_stats.dropped++;
+
+        return -1;
+    }
+
+    memset(&queue_record, 0xff, sizeof(queue_record));
+    queue_record.Sequence = queue_sequence++;
+    queue_record.Length = data_len;
+    queue_record.AppPort = app_port;
+    queue_record.Flags = confirmed ? QUEUE_FLAG_CONFIRMED : 0;
+    queue_record.Priority = priority;
+    memcpy(queue_record.Data, data, data_len);
+    queue_record.Crc32 = Crc32((uint8_t*)&queue_record, QUEUE_RECORD_CRC_SIZE);
+
+    QueueProgram(slot * FLASH_PAGE_SIZE, (uint8_t*)&queue_record);
+
+    QueueSlotSetPending(slot, true);
+    queue_pending++;
+    queue_stats.appended++;
+
+    return 0;
+}
+
+int lorawan_queue_process()
+{
+    int result;
+
+    if (queue_settings == NULL) {
+        return -1;
+    }
+
+    if (queue_pending == 0 || !lorawan_is_joined() || lorawan_next_tx_in_ms() != 0) {
+        return 0;
+    }
+
+    int slot = QueueNext(false);
+
+    // a record that does not fit the current data rate waits for it to go
+    // up, the MAC would send an empty frame in its place. The records behind
+    // it wait too, so they are still sent in order.
+    if (slot < 0 || QueueSlot(slot)->Length > lorawan_max_payload_now()) {
+        return 0;
+    }
+
+    // the send buffer must not be in flash that is about to be programmed
+    memcpy(&queue_record, QueueSlot(slot), sizeof(queue_record));
+
+    if (queue_record.Flags & QUEUE_FLAG_CONFIRMED) {
+        result = lorawan_send_confirmed(queue_record.Data, queue_record.Length, queue_record.AppPort);
+    } else {
+        result = lorawan_send_unconfirmed(queue_record.Data, queue_record.Length, queue_record.AppPort);
+    }
+
+    if (result != 0) {
+        // stays queued and is retried on the next call
+        return -1;
+    }
+
+    QueueConsume(slot);
+
+    queue_stats.sent++;
+
+    return 0;
+}
+
+int lorawan_queue_count()
+{
+    return queue_pending;
+}
+
+int lorawan_queue_erase()
+{
+    if (queue_settings == NULL) {
+        return -1;
+    }
+
+    for (uint16_t sector = 0; sector < LORAWAN_QUEUE_SECTORS; sector++) {
+        QueueEraseSector(sector);
+    }
+
+    queue_write_slot = 0;
+    queue_pending = 0;
+
+    memset(queue_pending_slots, 0, sizeof(queue_pending_slots));
+
+    return 0;
+}
+
+int lorawan_queue_get_stats(struct lorawan_queue_stats* stats)
+{
+    if (stats == NULL) {
+        return -1;
+    }
+
+    *stats = queue_stats;
+
+    return 0;
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+#include <string.h>
+
+#include "pico/rand.h"
+#include "pico/time.h"
+
+#include "pico/lorawan.h"
+#include "pico/lorawan_reliable.h"
+
+typedef struct {
+    bool used;
+    // waiting to be (re)sent
+    bool transmit;
+    bool sent;
+    uint8_t retries;
+    uint16_t sequence;
+    absolute_time_t ack_deadline;
+    uint8_t length;
+    uint8_t frame[LORAWAN_RELIABLE_HEADER_SIZE + LORAWAN_RELIABLE_MAX_PAYLOAD];
+} ReliableEntry_t;
+
+static const struct lorawan_reliable_settings* reliable_settings = NULL;
+
+static ReliableEntry_t reliable_window[LORAWAN_RELIABLE_WINDOW];
+static uint16_t reliable_sequence = 0;
+
+// picked on init from the hardware entropy sources (which do not depend on
+// the LoRaWAN stack being initialized), so ACKs for uplinks from before a
+// reset are ignored
+static uint16_t reliable_epoch;
+
+static struct lorawan_reliable_stats reliable_stats;
+
+// difference between sequence numbers that may have wrapped
+static int16_t ReliableSequenceDiff(uint16_t a, uint16_t b)
+{
+    return (int16_t)(a - b);
+}
+
+static ReliableEntry_t* ReliableOldest(bool transmit)
+{
+    ReliableEntry_t* oldest = NULL;
+
+    for (int i = 0; i < LORAWAN_RELIABLE_WINDOW; i++) {
+        ReliableEntry_t* entry = &reliable_window[i];
+
+        if (!entry->used || (transmit && !entry->transmit)) {
+            continue;
+        }
+
+        if (oldest == NULL || ReliableSequenceDiff(entry->sequence, oldest->sequence) < 0) {
+            oldest = entry;
+        }
+    }
+
+    return oldest;
+}
+
+int lorawan_reliable_init(const struct lorawan_reliable_settings* settings)
+{
+    if (settings == NULL || settings->app_port == settings->ack_port) {
+        return -1;
+    }
+
+    reliable_settings = settings;
+
+    memset(reliable_window, 0, sizeof(reliable_window));
+    memset(&reliable_stats, 0, sizeof(reliable_stats));
+
+    reliable_epoch = get_rand_32();
+    reliable_sequence = 0;
+
+    return 0;
+}
+
+int lorawan_reliable_send(const void* data, uint8_t data_len)
+{
+    if (reliable_settings == NULL || data == NULL || data_len > LORAWAN_RELIABLE_MAX_PAYLOAD) {
+        return -1;
+    }
+
+    // the MAC would send an empty frame in place of an oversize one
+    if (LORAWAN_RELIABLE_HEADER_SIZE + data_len > lorawan_max_payload_now()) {
+        return -1;
+    }
+
+    for (int i = 0; i < LORAWAN_RELIABLE_WINDOW; i++) {
+        ReliableEntry_t* entry = &reliable_window[i];
+
+        if (entry->used) {
+            continue;
+        }
+
+        entry->used = true;
+        entry->transmit = true;
+        entry->sent = false;
+        entry->retries = 0;
+        entry->sequence = reliable_sequence++;
+        entry->frame[0] = reliable_epoch & 0xff;
+        entry->frame[1] = reliable_epoch >> 8;
+        entry->frame[2] = entry->sequence & 0xff;
+        entry->frame[3] = entry->sequence >> 8;
+        memcpy(&entry->frame[LORAWAN_RELIABLE_HEADER_SIZE], data, data_len);
+        entry->length = LORAWAN_RELIABLE_HEADER_SIZE + data_len;
+
+        return 0;
+    }
+
+    // the window is full until the oldest uplinks are acknowledged
+    return -1;
+}
+
+int lorawan_reliable_process()
+{
+    if (reliable_settings == NULL) {
+        return -1;
+    }
+
+    // uplinks not acknowledged in time are resent, or dropped once out of retries
+    for (int i = 0; i < LORAWAN_RELIABLE_WINDOW; i++) {
+        ReliableEntry_t* entry = &reliable_window[i];
+
+        if (!entry->used || entry->transmit || !time_reached(entry->ack_deadline)) {
+            continue;
+        }
+
+        if (entry->retries >= reliable_settings->max_retries) {
+            entry->used = false;
+            reliable_stats.dropped++;
+        } else {
+            entry->transmit = true;
+        }
+    }
+
+    if (!lorawan_is_joined() || lorawan_next_tx_in_ms() != 0) {
+        return 0;
+    }
+
+    ReliableEntry_t* entry = ReliableOldest(true);
+
+    if (entry == NULL) {
+        return 0;
+    }
+
+    // the data rate dropped since it was queued, wait for it to fit again
+    if (entry->length > lorawan_max_payload_now()) {
+        return 0;
+    }
+
+    if (lorawan_send_unconfirmed(entry->frame, entry->length, reliable_settings->app_port) != 0) {
+        return -1;
+    }
+
+    if (!entry->sent) {
+        entry->sent = true;
+        reliable_stats.sent++;
+    } else {
+        entry->retries++;
+        reliable_stats.retransmissions++;
+    }
+
+    entry->transmit = false;
+    entry->ack_deadline = make_timeout_time_ms(reliable_settings->ack_timeout_ms);
+
+    return 0;
+}
+
+// ACK downlink: 16 bit epoch, 16 bit base sequence number, then a bitmap where bit
+// n of byte n / 8 is set if base + n was received. Everything sent before
+// base is acknowledged, clear bits before the last set bit are lost and
+// resent.
+int lorawan_reliable_receive(const uint8_t* data, int data_len, uint8_t app_port)
+{
+    if (reliable_settings == NULL || data == NULL || app_port != reliable_settings->ack_port) {
+        return 0;
+    }
+
+    if (data_len < 4 || (data[0] | (data[1] << 8)) != reliable_epoch) {
+        return 1;
+    }
+
+    const uint8_t* bitmap = &data[4];
+    uint16_t base = data[2] | (data[3] << 8);
+    int bits = (data_len - 4) * 8;
+    int last_received = -1;
+
+    reliable_stats.acks_received++;
+
+    for (int n = 0; n < bits; n++) {
+        if (bitmap[n / 8] & (1 << (n % 8))) {
+            last_received = n;
+        }
+    }
+
+    for (int i = 0; i < LORAWAN_RELIABLE_WINDOW; i++) {
+        ReliableEntry_t* entry = &reliable_window[i];
+
+        // uplinks not sent yet can not have been received
+        if (!entry->used || !entry->sent) {
+            continue;
+        }
+
+        int16_t n = ReliableSequenceDiff(entry->sequence, base);
+
+        if (n < 0 || (n < bits && (bitmap[n / 8] & (1 << (n % 8))))) {
+            entry->used = false;
+            reliable_stats.acknowledged++;
+        } else if (n < last_received && !entry->transmit) {
+            if (entry->retries >= reliable_settings->max_retries) {
+                entry->used = false;
+                reliable_stats.dropped++;
+            } else {
+                entry->transmit = true;
+            }
+        }
+    }
+
+    return 1;
+}
+
+int lorawan_reliable_pending()
+{
+    int pending = 0;
+
+    for (int i = 0; i < LORAWAN_RELIABLE_WINDOW; i++) {
+        pending += reliable_window[i].used;
+    }
+
+    return pending;
+}
+
+int lorawan_reliable_get_stats(struct lorawan_reliable_stats* stats)
+{
+    if (stats == NULL) {
+        return -1;
+    }
+
+    *stats = reliable_stats;
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "pico/time.h"
+
+#include "pico/lorawan_report.h"
+
+static uint32_t ReportNowMs()
+{
+    return to_ms_since_boot(get_absolute_time());
+}
+
+static bool ReportChangeDue(const struct lorawan_report_channel_settings* settings, const struct lorawan_report_channel* channel, float value, uint32_t now)
+{
+    if (settings->deadband > 0) {
+        float change = value - channel->reported;
+        int8_t direction = (change > 0) ? 1 : ((change < 0) ? -1 : 0);
+        float threshold = settings->deadband;
+
+        // moving back towards where the value came from needs to clear the hysteresis too
+        if (direction != 0 && direction == -channel->direction) {
+            threshold += settings->hysteresis;
+        }
+
+        if (fabsf(change) >= threshold) {
+            return true;
+        }
+    }
+
+    if (settings->rate_threshold > 0 && channel->sampled && now != channel->sample_time_ms) {
+        float rate = fabsf(value - channel->sample) * 1000.0f / (now - channel->sample_time_ms);
+
+        if (rate >= settings->rate_threshold) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int lorawan_report_init(struct lorawan_report* report, const struct lorawan_report_channel_settings* settings, uint8_t channel_count)
+{
+    if (report == NULL || settings == NULL || channel_count == 0 || channel_count > LORAWAN_REPORT_MAX_CHANNELS) {
+        return -1;
+    }
+
+    memset(report, 0, sizeof(*report));
+
+    report->settings = settings;
+    report->channel_count = channel_count;
+
+    return 0;
+}
+
+int lorawan_report_sample(struct lorawan_report* report, uint8_t channel, float value)
+{
+    if (report == NULL || channel >= report->channel_count) {
+        return -1;
+    }
+
+    struct lorawan_report_channel* state = &report->channels[channel];
+    uint32_t now = ReportNowMs();
+
+    if (!state->has_reported || ReportChangeDue(&report->settings[channel], state, value, now)) {
+        // stays due until the report is sent
+        state->due = true;
+    }
+
+    state->sample = value;
+    state->sample_time_ms = now;
+    state->sampled = true;
+
+    report->samples++;
+
+    return state->due ? 1 : 0;
+}
+
+bool lorawan_report_due(struct lorawan_report* report)
+{
+    uint32_t now = ReportNowMs();
+
+    for (int i = 0; i < report->channel_count; i++) {
+        const struct lorawan_report_channel* state = &report->channels[i];
+        uint32_t max_silence_ms = report->settings[i].max_silence_ms;
+
+        if (state->due) {
+            return true;
+        }
+
+        if (max_silence_ms != 0 && state->has_reported && (now - state->reported_time_ms) >= max_silence_ms) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void lorawan_report_sent(struct lorawan_report* report)
+{
+    uint32_t now = ReportNowMs();
+
+    for (int i = 0; i < report->channel_count; i++) {
+        struct lorawan_report_channel* state = &report->channels[i];
+
+        if (!state->sampled) {
+            continue;
+        }
+
+        if (state->has_reported && state->sample != state->reported) {
+            state->direction = (state->sample > state->reported) ? 1 : -1;
+        }
+
+        state->reported = state->sample;
+        state->reported_time_ms = now;
+        state->has_reported = true;
+        state->due = false;
+    }
+
+    report->reports++;
+}
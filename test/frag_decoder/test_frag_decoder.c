@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ *
+ * Host test of src/frag_decoder.c against LoRaMac-node's FragDecoder.c: both
+ * decoders are fed the same random sessions (losses, duplicates and
+ * reordering) and must return the same status and hold the same file after
+ * every fragment.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FragDecoder.h"
+
+// FragDecoder.c is built with its functions renamed, see CMakeLists.txt
+void RefFragDecoderInit( uint16_t fragNb, uint8_t fragSize, FragDecoderCallbacks_t* callbacks );
+int32_t RefFragDecoderProcess( uint16_t fragCounter, uint8_t* rawData );
+FragDecoderStatus_t RefFragDecoderGetStatus( void );
+
+#define SESSIONS        2000
+#define MAX_PARITY      ( FRAG_MAX_NB / 2 )
+
+static uint8_t Original[FRAG_MAX_NB * FRAG_MAX_SIZE];
+static uint8_t File[FRAG_MAX_NB * FRAG_MAX_SIZE];
+static uint8_t RefFile[FRAG_MAX_NB * FRAG_MAX_SIZE];
+
+static uint32_t RandomState = 1;
+
+static uint32_t Random( void )
+{
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 17;
+    RandomState ^= RandomState << 5;
+
+    return RandomState;
+}
+
+static int8_t FileWrite( uint32_t addr, uint8_t* data, uint32_t size )
+{
+    memcpy( File + addr, data, size );
+    return 0;
+}
+
+static int8_t FileRead( uint32_t addr, uint8_t* data, uint32_t size )
+{
+    memcpy( data, File + addr, size );
+    return 0;
+}
+
+static int8_t RefFileWrite( uint32_t addr, uint8_t* data, uint32_t size )
+{
+    memcpy( RefFile + addr, data, size );
+    return 0;
+}
+
+static int8_t RefFileRead( uint32_t addr, uint8_t* data, uint32_t size )
+{
+    memcpy( data, RefFile + addr, size );
+    return 0;
+}
+
+static FragDecoderCallbacks_t Callbacks = { .FragDecoderWrite = FileWrite, .FragDecoderRead = FileRead };
+static FragDecoderCallbacks_t RefCallbacks = { .FragDecoderWrite = RefFileWrite, .FragDecoderRead = RefFileRead };
+
+static uint32_t Prbs23( uint32_t value )
+{
+    uint32_t b0 = value & 0x01;
+    uint32_t b1 = ( value & 0x20 ) >> 5;
+
+    return ( value >> 1 ) + ( ( b0 ^ b1 ) << 22 );
+}
+
+// Parity fragment n (1 based) as sent by the server
+static void EncodeParity( uint32_t n, uint32_t m, uint32_t size, uint8_t* fragment )
+{
+    static uint8_t row[FRAG_MAX_NB];
+    uint32_t mTemp = ( ( m & ( m - 1 ) ) == 0 ) ? 1 : 0;
+    uint32_t x = 1 + ( 1001 * n );
+
+    memset( row, 0, m );
+
+    for( uint32_t nbCoeff = 0; nbCoeff < ( m >> 1 ); nbCoeff++ )
+    {
+        uint32_t r = 1 << 16;
+
+        while( r >= m )
+        {
+            x = Prbs23( x );
+            r = x % ( m + mTemp );
+        }
+        row[r] = 1;
+    }
+
+    memset( fragment, 0, size );
+
+    for( uint32_t i = 0; i < m; i++ )
+    {
+        if( row[i] != 0 )
+        {
+            for( uint32_t k = 0; k < size; k++ )
+            {
+                fragment[k] ^= Original[i * size + k];
+            }
+        }
+    }
+}
+
+static int Compare( uint32_t session, uint16_t counter, int32_t status, int32_t refStatus, uint32_t fileSize )
+{
+    FragDecoderStatus_t s = FragDecoderGetStatus( );
+    FragDecoderStatus_t r = RefFragDecoderGetStatus( );
+
+    if( ( status != refStatus ) || ( s.FragNbRx != r.FragNbRx ) || ( s.FragNbLost != r.FragNbLost ) ||
+        ( s.FragNbLastRx != r.FragNbLastRx ) || ( s.MatrixError != r.MatrixError ) )
+    {
+        printf( "session %u, fragment %u: status %d/%d, rx %u/%u, lost %u/%u, last rx %u/%u, matrix error %u/%u\n",
+                session, counter, status, refStatus, s.FragNbRx, r.FragNbRx, s.FragNbLost, r.FragNbLost,
+                s.FragNbLastRx, r.FragNbLastRx, s.MatrixError, r.MatrixError );
+        return -1;
+    }
+
+    if( memcmp( File, RefFile, fileSize ) != 0 )
+    {
+        printf( "session %u, fragment %u: file differs\n", session, counter );
+        return -1;
+    }
+
+    return 0;
+}
+
+int main( int argc, char** argv )
+{
+    static uint16_t counters[2 * ( FRAG_MAX_NB + MAX_PARITY )];
+    uint8_t fragment[FRAG_MAX_SIZE];
+    uint8_t refFragment[FRAG_MAX_SIZE];
+    uint32_t decoded = 0;
+    uint32_t skipped = 0;
+
+    if( argc > 1 )
+    {
+        RandomState = strtoul( argv[1], NULL, 0 ) | 1;
+    }
+
+    for( uint32_t session = 0; session < SESSIONS; session++ )
+    {
+        uint16_t fragNb = 1 + Random( ) % FRAG_MAX_NB;
+        uint8_t fragSize = 1 + Random( ) % FRAG_MAX_SIZE;
+        uint32_t parity = Random( ) % ( MAX_PARITY + 1 );
+        uint32_t lossPercent = Random( ) % 31;
+        uint32_t fileSize = fragNb * fragSize;
+        uint32_t count = 0;
+        uint32_t lastRx = 0;
+        uint32_t accepted = 0;
+        int32_t status = FRAG_SESSION_ONGOING;
+
+        for( uint32_t i = 0; i < fileSize; i++ )
+        {
+            Original[i] = Random( );
+        }
+
+        // lost, duplicated and swapped fragments
+        for( uint16_t n = 1; n <= fragNb + parity; n++ )
+        {
+            if( ( Random( ) % 100 ) < lossPercent )
+            {
+                continue;
+            }
+
+            counters[count++] = n;
+
+            if( ( Random( ) % 50 ) == 0 )
+            {
+                counters[count++] = n;
+            }
+
+            if( ( count > 1 ) && ( ( Random( ) % 50 ) == 0 ) )
+            {
+                uint16_t swap = counters[count - 1];
+
+                counters[count - 1] = counters[count - 2];
+                counters[count - 2] = swap;
+            }
+        }
+
+        // More than FRAG_MAX_REDUNDANCY lost fragments overflow the
+        // reference decoder's matrix before it reports the error
+        for( uint32_t i = 0; i < count; i++ )
+        {
+            if( counters[i] < lastRx )
+            {
+                continue;
+            }
+
+            if( counters[i] <= fragNb )
+            {
+                accepted += ( counters[i] != lastRx );
+                lastRx = counters[i];
+            }
+            else
+            {
+                lastRx = fragNb + 1;
+            }
+        }
+
+        if( ( fragNb - accepted ) > FRAG_MAX_REDUNDANCY )
+        {
+            skipped++;
+            continue;
+        }
+
+        FragDecoderInit( fragNb, fragSize, &Callbacks );
+        RefFragDecoderInit( fragNb, fragSize, &RefCallbacks );
+
+        // the reference only resets the loss counters, not FragNbRx
+        if( memcmp( File, RefFile, fileSize ) != 0 )
+        {
+            printf( "session %u: erased file differs\n", session );
+            return 1;
+        }
+
+        for( uint32_t i = 0; ( i < count ) && ( status < 0 ); i++ )
+        {
+            uint16_t n = counters[i];
+            int32_t refStatus;
+
+            if( n <= fragNb )
+            {
+                memcpy( fragment, Original + ( n - 1 ) * fragSize, fragSize );
+            }
+            else
+            {
+                EncodeParity( n - fragNb, fragNb, fragSize, fragment );
+            }
+
+            // the reference decodes in place
+            memcpy( refFragment, fragment, fragSize );
+
+            status = FragDecoderProcess( n, fragment );
+            refStatus = RefFragDecoderProcess( n, refFragment );
+
+            if( Compare( session, n, status, refStatus, fileSize ) != 0 )
+            {
+                return 1;
+            }
+        }
+
+        if( ( status >= 0 ) && ( FragDecoderGetStatus( ).MatrixError == 0 ) )
+        {
+            if( memcmp( File, Original, fileSize ) != 0 )
+            {
+                printf( "session %u: decoded file differs from the original\n", session );
+                return 1;
+            }
+            decoded++;
+        }
+    }
+
+    printf( "%u sessions match, %u decoded, %u skipped\n", SESSIONS - skipped, decoded, skipped );
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+// only depends on the C library, it is built on a host to reassemble transfers
+
+#include <stddef.h>
+#include <string.h>
+
+#include "lorawan_bulk_reassembly.h"
+
+static bool ReassemblyHas(const struct lorawan_bulk_reassembly* reassembly, uint16_t fragment)
+{
+    return (reassembly->bitmap[fragment / 8] & (1 << (fragment % 8))) != 0;
+}
+
+static void ReassemblyStore(struct lorawan_bulk_reassembly* reassembly, uint16_t fragment, const uint8_t* data)
+{
+    uint32_t offset = fragment * reassembly->fragment_size;
+    uint32_t len = reassembly->size - offset;
+
+    if (len > reassembly->fragment_size) {
+        len = reassembly->fragment_size;
+    }
+
+    memcpy(reassembly->buffer + offset, data, len);
+
+    reassembly->bitmap[fragment / 8] |= (1 << (fragment % 8));
+    reassembly->received++;
+}
+
+void lorawan_bulk_reassembly_init(struct lorawan_bulk_reassembly* reassembly, void* buffer, uint16_t buffer_size)
+{
+    memset(reassembly, 0, sizeof(*reassembly));
+
+    reassembly->buffer = buffer;
+    reassembly->buffer_size = buffer_size;
+}
+
+int lorawan_bulk_reassembly_add(struct lorawan_bulk_reassembly* reassembly, const uint8_t* fragment, uint8_t len)
+{
+    if (reassembly == NULL || fragment == NULL || len <= LORAWAN_BULK_HEADER_SIZE) {
+        return -1;
+    }
+
+    uint8_t id = fragment[0];
+    uint8_t parity_group = fragment[1];
+    uint16_t index = fragment[2] | (fragment[3] << 8);
+    uint16_t size = fragment[4] | (fragment[5] << 8);
+    uint8_t fragment_size = len - LORAWAN_BULK_HEADER_SIZE;
+    const uint8_t* data = &fragment[LORAWAN_BULK_HEADER_SIZE];
+
+    // a fragment of a new transfer restarts reassembly
+    if (!reassembly->started || id != reassembly->id || size != reassembly->size ||
+        fragment_size != reassembly->fragment_size || parity_group != reassembly->parity_group) {
+        uint16_t fragments = (size + fragment_size - 1) / fragment_size;
+
+        if (size == 0 || size > reassembly->buffer_size || fragments > LORAWAN_BULK_MAX_FRAGMENTS) {
+            return -1;
+        }
+
+        memset(reassembly->bitmap, 0, sizeof(reassembly->bitmap));
+
+        reassembly->started = true;
+        reassembly->id = id;
+        reassembly->parity_group = parity_group;
+        reassembly->fragment_size = fragment_size;
+        reassembly->size = size;
+        reassembly->fragments = fragments;
+        reassembly->received = 0;
+    }
+
+    if (index & LORAWAN_BULK_PARITY_FLAG) {
+        uint16_t group = index & ~LORAWAN_BULK_PARITY_FLAG;
+        uint32_t first = group * parity_group;
+        uint32_t last = first + parity_group;
+        uint8_t recovered[255];
+        int missing = -1;
+
+        if (parity_group == 0 || first >= reassembly->fragments) {
+            return -1;
+        }
+
+        if (last > reassembly->fragments) {
+            last = reassembly->fragments;
+        }
+
+        memcpy(recovered, data, fragment_size);
+
+        // parity is sent after its group, so one lost fragment can be rebuilt from the rest
+        for (uint32_t i = first; i < last; i++) {
+            if (!ReassemblyHas(reassembly, i)) {
+                if (missing >= 0) {
+                    // more than one lost
+                    return 0;
+                }
+
+                missing = i;
+                continue;
+            }
+
+            uint32_t offset = i * fragment_size;
+            uint32_t fragment_len = reassembly->size - offset;
+
+            if (fragment_len > fragment_size) {
+                fragment_len = fragment_size;
+            }
+
+            for (uint32_t j = 0; j < fragment_len; j++) {
+                recovered[j] ^= reassembly->buffer[offset + j];
+            }
+        }
+
+        if (missing >= 0) {
+            ReassemblyStore(reassembly, missing, recovered);
+        }
+    } else {
+        if (index >= reassembly->fragments) {
+            return -1;
+        }
+
+        if (!ReassemblyHas(reassembly, index)) {
+            ReassemblyStore(reassembly, index, data);
+        }
+    }
+
+    return (reassembly->received == reassembly->fragments) ? 1 : 0;
+}
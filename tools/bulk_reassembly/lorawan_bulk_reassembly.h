@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ * 
+ */
+
+#ifndef _LORAWAN_BULK_REASSEMBLY_H_
+#define _LORAWAN_BULK_REASSEMBLY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pico/lorawan_bulk.h"
+
+struct lorawan_bulk_reassembly {
+    uint8_t* buffer;
+    uint16_t buffer_size;
+
+    bool started;
+    uint8_t id;
+    uint8_t parity_group;
+    uint8_t fragment_size;
+    uint16_t size;
+    uint16_t fragments;
+    uint16_t received;
+    uint8_t bitmap[LORAWAN_BULK_MAX_FRAGMENTS / 8];
+};
+
+void lorawan_bulk_reassembly_init(struct lorawan_bulk_reassembly* reassembly, void* buffer, uint16_t buffer_size);
+
+int lorawan_bulk_reassembly_add(struct lorawan_bulk_reassembly* reassembly, const uint8_t* fragment, uint8_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif